@@ -0,0 +1,518 @@
+#include <algorithm>
+#include "include/apu.hpp"
+#include "include/audio_ring.hpp"
+#include "include/cartridge.hpp"
+#include "include/console.hpp"
+#include "include/cpu.hpp"
+
+namespace {
+
+    const u8 lengthTable[32] = {
+            10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+            12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+    };
+
+    const u8 dutyTable[4][8] = {
+            {0, 1, 0, 0, 0, 0, 0, 0},
+            {0, 1, 1, 0, 0, 0, 0, 0},
+            {0, 1, 1, 1, 1, 0, 0, 0},
+            {1, 0, 0, 1, 1, 1, 1, 1}
+    };
+
+    const u8 triangleTable[32] = {
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+
+    //NTSC periods in CPU cycles
+    const u16 noiseTable[16] = {
+            4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+    };
+
+    const u16 dmcTable[16] = {
+            428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+    };
+
+    /**
+     * frame counter steps, CPU cycles into the sequence.  The 5 step
+     * sequence's empty fourth step is left out.
+     */
+    const int frameSteps[2][4] = {
+            {7457, 14913, 22371, 29829},
+            {7457, 14913, 22371, 37281}
+    };
+    const int frameLength[2] = {29830, 37282};
+
+    /**
+     * the console's nonlinear mixer, the approximation from the nesdev
+     * wiki, looked up by the sum of the pulses and by 3 * triangle +
+     * 2 * noise + DMC, comes out between 0 and 1
+     */
+    struct MixTables {
+        float pulse[31];
+        float tnd[203];
+
+        MixTables() {
+            pulse[0] = 0;
+            for (int i = 1; i < 31; i++) {
+                pulse[i] = 95.52f / (8128.0f / i + 100);
+            }
+            tnd[0] = 0;
+            for (int i = 1; i < 203; i++) {
+                tnd[i] = 163.67f / (24329.0f / i + 100);
+            }
+        }
+    };
+
+    const MixTables mixTables;
+}
+
+APU::APU(Console &console) : cpu(console.cpu), cartridge(console.cartridge) {}
+
+void APU::power() {
+    *static_cast<APUState *>(this) = APUState();
+    clock = cpu.cycles;
+    frameStart = clock;
+    noise.shift = 1;
+    noise.period = noiseTable[0];
+    dmc.period = dmcTable[0];
+    dmc.timer = dmc.period;
+    dmc.bits = 8;
+    dmc.silence = true;
+    // timers count down to 0 before they fire, so never start at 0
+    pulse[0].timer = pulse[1].timer = triangle.timer = 1;
+    noise.timer = noise.period;
+    level = 0;
+    blip.clear();
+    predictEvent();
+}
+
+void APU::set_output(AudioRing *ring, int rate) {
+    output = rate > 0 ? ring : nullptr;
+    sampleRate = rate;
+    if (output != nullptr) {
+        blip.set_rates(CPU_HZ, sampleRate);
+    }
+    blip.clear();
+}
+
+void APU::set_rate_ratio(double ratio) {
+    if (output != nullptr) {
+        blip.set_rates(CPU_HZ, sampleRate * ratio);
+    }
+}
+
+/* channel outputs, 0-15 */
+
+u16 APU::sweep_target(const Pulse &p, int channel) const {
+    u16 change = p.period >> p.sweepShift;
+    if (!p.sweepNegate) {
+        return p.period + change;
+    }
+    // pulse 1 negates with ones' complement
+    return p.period - change - (channel == 0 ? 1 : 0);
+}
+
+u8 APU::pulse_output(const Pulse &p, int channel) const {
+    if (p.length == 0 || p.period < 8 || sweep_target(p, channel) > 0x7FF
+        || !dutyTable[p.duty][p.step]) {
+        return 0;
+    }
+    return p.envelope.constant ? p.envelope.period : p.envelope.decay;
+}
+
+u8 APU::triangle_output() const {
+    return triangleTable[triangle.step];
+}
+
+u8 APU::noise_output() const {
+    if (noise.length == 0 || (noise.shift & 1)) {
+        return 0;
+    }
+    return noise.envelope.constant ? noise.envelope.period : noise.envelope.decay;
+}
+
+float APU::mix() const {
+    int p = pulse_output(pulse[0], 0) + pulse_output(pulse[1], 1);
+    int tnd = 3 * triangle_output() + 2 * noise_output() + dmc.output;
+    return mixTables.pulse[p] + mixTables.tnd[tnd];
+}
+
+//tell the blip buffer if the output moved since it last heard
+void APU::update_level() {
+    float now = mix();
+    if (now != level) {
+        blip.add_delta(now - level);
+        level = now;
+    }
+}
+
+/* frame counter */
+
+void APU::clock_envelope(Envelope &e) {
+    if (e.start) {
+        e.start = false;
+        e.decay = 15;
+        e.divider = e.period;
+    } else if (e.divider == 0) {
+        e.divider = e.period;
+        if (e.decay > 0) {
+            e.decay--;
+        } else if (e.loop) {
+            e.decay = 15;
+        }
+    } else {
+        e.divider--;
+    }
+}
+
+void APU::clock_sweep(Pulse &p, int channel) {
+    u16 target = sweep_target(p, channel);
+    if (p.sweepDivider == 0 && p.sweepEnabled && p.sweepShift > 0 && p.period >= 8 && target <= 0x7FF) {
+        p.period = target;
+    }
+    if (p.sweepDivider == 0 || p.sweepReload) {
+        p.sweepDivider = p.sweepPeriod;
+        p.sweepReload = false;
+    } else {
+        p.sweepDivider--;
+    }
+}
+
+void APU::quarter_frame() {
+    clock_envelope(pulse[0].envelope);
+    clock_envelope(pulse[1].envelope);
+    clock_envelope(noise.envelope);
+    if (triangle.linearReload) {
+        triangle.linear = triangle.linearPeriod;
+    } else if (triangle.linear > 0) {
+        triangle.linear--;
+    }
+    if (!triangle.control) {
+        triangle.linearReload = false;
+    }
+}
+
+void APU::half_frame() {
+    for (int i = 0; i < 2; i++) {
+        if (!pulse[i].envelope.loop && pulse[i].length > 0) {
+            pulse[i].length--;
+        }
+        clock_sweep(pulse[i], i);
+    }
+    if (!triangle.control && triangle.length > 0) {
+        triangle.length--;
+    }
+    if (!noise.envelope.loop && noise.length > 0) {
+        noise.length--;
+    }
+}
+
+void APU::frame_step() {
+    quarter_frame();
+    if (frameStep & 1) {
+        half_frame();
+    }
+    if (frameStep == 3 && !fiveStep && !irqInhibit) {
+        frameIrq = true;
+    }
+    if (++frameStep == 4) {
+        frameStep = 0;
+        frameStart += frameLength[fiveStep];
+    }
+}
+
+/* DMC */
+
+/**
+ * the DMC reads its next byte over the CPU's bus, which stalls the CPU
+ * for a few cycles
+ */
+void APU::dmc_fetch() {
+    dmc.buffer = cartridge.prg_read(dmc.address);
+    dmc.bufferFull = true;
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+    stall += 4;
+    if (--dmc.remaining == 0) {
+        if (dmc.loop) {
+            dmc.address = dmc.sampleAddress;
+            dmc.remaining = dmc.sampleLength;
+        } else if (dmc.irqEnabled) {
+            dmcIrq = true;
+        }
+    }
+}
+
+void APU::clock_dmc() {
+    if (!dmc.silence) {
+        if (dmc.shift & 1) {
+            if (dmc.output <= 125) {
+                dmc.output += 2;
+            }
+        } else if (dmc.output >= 2) {
+            dmc.output -= 2;
+        }
+    }
+    dmc.shift >>= 1;
+    if (--dmc.bits == 0) {
+        dmc.bits = 8;
+        dmc.silence = !dmc.bufferFull;
+        dmc.shift = dmc.buffer;
+        dmc.bufferFull = false;
+        if (dmc.remaining > 0) {
+            dmc_fetch();
+        }
+    }
+}
+
+/* running */
+
+void APU::run_dmc(s64 cycles) {
+    while (cycles >= dmc.timer) {
+        cycles -= dmc.timer;
+        dmc.timer = dmc.period;
+        clock_dmc();
+    }
+    dmc.timer -= cycles;
+}
+
+/**
+ * Without anyone listening only the DMC needs to run, nothing else the
+ * timers drive can be seen by the CPU.  Otherwise the APU jumps from one
+ * timer firing to the next and only tells the blip buffer when the mix
+ * changes, a channel that can't be heard right now isn't run at all.
+ */
+void APU::run(s64 until) {
+    if (until <= clock) {
+        return;
+    }
+    if (!listening()) {
+        run_dmc(until - clock);
+        clock = until;
+        return;
+    }
+
+    // register writes and frame counter steps since the last run
+    update_level();
+    while (clock < until) {
+        bool pulse0 = pulse[0].length > 0 && pulse[0].period >= 8;
+        bool pulse1 = pulse[1].length > 0 && pulse[1].period >= 8;
+        // ultrasonic periods would only click, leave the wave where it is
+        bool tri = triangle.linear > 0 && triangle.length > 0 && triangle.period >= 2;
+        bool noisy = noise.length > 0;
+
+        s64 step = until - clock;
+        if (pulse0 && pulse[0].timer < step) step = pulse[0].timer;
+        if (pulse1 && pulse[1].timer < step) step = pulse[1].timer;
+        if (tri && triangle.timer < step) step = triangle.timer;
+        if (noisy && noise.timer < step) step = noise.timer;
+        if (dmc.timer < step) step = dmc.timer;
+
+        clock += step;
+        blip.advance(step);
+        for (int i = 0; i < 2; i++) {
+            Pulse &p = pulse[i];
+            if ((i == 0 ? pulse0 : pulse1) && (p.timer -= step) == 0) {
+                p.timer = (p.period + 1) * 2;
+                p.step = (p.step + 1) & 7;
+            }
+        }
+        if (tri && (triangle.timer -= step) == 0) {
+            triangle.timer = triangle.period + 1;
+            triangle.step = (triangle.step + 1) & 31;
+        }
+        if (noisy && (noise.timer -= step) == 0) {
+            noise.timer = noise.period;
+            u16 feedback = (noise.shift ^ (noise.shift >> (noise.mode ? 6 : 1))) & 1;
+            noise.shift = (noise.shift >> 1) | (feedback << 14);
+        }
+        if ((dmc.timer -= step) == 0) {
+            dmc.timer = dmc.period;
+            clock_dmc();
+        }
+        update_level();
+    }
+}
+
+/*
+ * a full ring drops what doesn't fit, the emulation thread never waits
+ * for the audio device
+ */
+void APU::flush() {
+    int n = blip.read(samples, BlipBuffer::SIZE);
+    if (n > 0) {
+        output->push(samples, n);
+    }
+}
+
+void APU::predictEvent() {
+    eventClock = frameStart + frameSteps[fiveStep][frameStep];
+    if (dmc.remaining > 0) {
+        eventClock = std::min(eventClock, clock + dmc.timer + (s64) (dmc.bits - 1) * dmc.period);
+    }
+    if (stall > 0) {
+        // the CPU has to pay for the fetch before it carries on
+        eventClock = clock;
+    }
+}
+
+void APU::sync() {
+    for (;;) {
+        s64 step = frameStart + frameSteps[fiveStep][frameStep];
+        if (step > cpu.cycles) {
+            break;
+        }
+        run(step);
+        frame_step();
+        if (listening()) {
+            flush();
+        }
+    }
+    run(cpu.cycles);
+    if (listening()) {
+        flush();
+    }
+    cpu.set_irq(frameIrq || dmcIrq);
+    predictEvent();
+}
+
+/* registers */
+
+void APU::write(u16 addr, u8 v) {
+    switch (addr) {
+        case 0x4000:
+        case 0x4004: {
+            Pulse &p = pulse[(addr - 0x4000) / 4];
+            p.duty = v >> 6;
+            p.envelope.loop = v & 0x20;
+            p.envelope.constant = v & 0x10;
+            p.envelope.period = v & 0xF;
+            break;
+        }
+        case 0x4001:
+        case 0x4005: {
+            Pulse &p = pulse[(addr - 0x4000) / 4];
+            p.sweepEnabled = v & 0x80;
+            p.sweepPeriod = (v >> 4) & 7;
+            p.sweepNegate = v & 0x08;
+            p.sweepShift = v & 7;
+            p.sweepReload = true;
+            break;
+        }
+        case 0x4002:
+        case 0x4006: {
+            Pulse &p = pulse[(addr - 0x4000) / 4];
+            p.period = (p.period & 0x700) | v;
+            break;
+        }
+        case 0x4003:
+        case 0x4007: {
+            Pulse &p = pulse[(addr - 0x4000) / 4];
+            p.period = (p.period & 0xFF) | (v & 7) << 8;
+            if (p.enabled) {
+                p.length = lengthTable[v >> 3];
+            }
+            p.step = 0;
+            p.envelope.start = true;
+            break;
+        }
+        case 0x4008:
+            triangle.control = v & 0x80;
+            triangle.linearPeriod = v & 0x7F;
+            break;
+        case 0x400A:
+            triangle.period = (triangle.period & 0x700) | v;
+            break;
+        case 0x400B:
+            triangle.period = (triangle.period & 0xFF) | (v & 7) << 8;
+            if (triangle.enabled) {
+                triangle.length = lengthTable[v >> 3];
+            }
+            triangle.linearReload = true;
+            break;
+        case 0x400C:
+            noise.envelope.loop = v & 0x20;
+            noise.envelope.constant = v & 0x10;
+            noise.envelope.period = v & 0xF;
+            break;
+        case 0x400E:
+            noise.mode = v & 0x80;
+            noise.period = noiseTable[v & 0xF];
+            break;
+        case 0x400F:
+            if (noise.enabled) {
+                noise.length = lengthTable[v >> 3];
+            }
+            noise.envelope.start = true;
+            break;
+        case 0x4010:
+            dmc.irqEnabled = v & 0x80;
+            if (!dmc.irqEnabled) {
+                dmcIrq = false;
+            }
+            dmc.loop = v & 0x40;
+            dmc.period = dmcTable[v & 0xF];
+            break;
+        case 0x4011:
+            dmc.output = v & 0x7F;
+            break;
+        case 0x4012:
+            dmc.sampleAddress = 0xC000 + v * 64;
+            break;
+        case 0x4013:
+            dmc.sampleLength = v * 16 + 1;
+            break;
+        case 0x4015:
+            pulse[0].enabled = v & 0x01;
+            pulse[1].enabled = v & 0x02;
+            triangle.enabled = v & 0x04;
+            noise.enabled = v & 0x08;
+            for (int i = 0; i < 2; i++) {
+                if (!pulse[i].enabled) {
+                    pulse[i].length = 0;
+                }
+            }
+            if (!triangle.enabled) {
+                triangle.length = 0;
+            }
+            if (!noise.enabled) {
+                noise.length = 0;
+            }
+            dmcIrq = false;
+            if (!(v & 0x10)) {
+                dmc.remaining = 0;
+            } else if (dmc.remaining == 0) {
+                dmc.address = dmc.sampleAddress;
+                dmc.remaining = dmc.sampleLength;
+                if (!dmc.bufferFull) {
+                    dmc_fetch();
+                }
+            }
+            break;
+        case 0x4017:
+            // the sequence restarts 3 or 4 cycles after the write
+            fiveStep = v & 0x80;
+            irqInhibit = v & 0x40;
+            if (irqInhibit) {
+                frameIrq = false;
+            }
+            frameStep = 0;
+            frameStart = clock + (clock & 1 ? 4 : 3);
+            if (fiveStep) {
+                quarter_frame();
+                half_frame();
+            }
+            break;
+    }
+    cpu.set_irq(frameIrq || dmcIrq);
+    predictEvent();
+}
+
+u8 APU::read_status() {
+    u8 status = (pulse[0].length > 0) | (pulse[1].length > 0) << 1
+                | (triangle.length > 0) << 2 | (noise.length > 0) << 3
+                | (dmc.remaining > 0) << 4 | frameIrq << 6 | dmcIrq << 7;
+    frameIrq = false;
+    cpu.set_irq(dmcIrq);
+    return status;
+}
@@ -0,0 +1,51 @@
+#include <algorithm>
+#include <cstring>
+#include "include/audio_ring.hpp"
+
+AudioRing::AudioRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    buffer = new s16[size]();
+    mask = size - 1;
+}
+
+AudioRing::~AudioRing() {
+    delete[] buffer;
+}
+
+/*
+ * copy in at most two pieces, before and after the end of the buffer,
+ * and only then publish the new head so the consumer never sees a
+ * sample that isn't written yet
+ */
+size_t AudioRing::push(const s16 *samples, size_t count) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    count = std::min(count, capacity() - (h - t));
+    size_t start = h & mask;
+    size_t first = std::min(count, capacity() - start);
+    memcpy(buffer + start, samples, first * sizeof(s16));
+    memcpy(buffer, samples + first, (count - first) * sizeof(s16));
+    head.store(h + count, std::memory_order_release);
+    return count;
+}
+
+size_t AudioRing::pop(s16 *out, size_t count) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    count = std::min(count, h - t);
+    size_t start = t & mask;
+    size_t first = std::min(count, capacity() - start);
+    memcpy(out, buffer + start, first * sizeof(s16));
+    memcpy(out + first, buffer, (count - first) * sizeof(s16));
+    tail.store(t + count, std::memory_order_release);
+    return count;
+}
+
+size_t AudioRing::size() const {
+    // tail first: head only grows, so it can't end up behind it
+    size_t t = tail.load(std::memory_order_acquire);
+    return head.load(std::memory_order_acquire) - t;
+}
@@ -0,0 +1,283 @@
+//
+// Batch front end: runs a list of ROMs, or the same ROM many times, for a
+// fixed number of frames each, spread across a pool of worker threads.
+// Every job gets its own Console, the ROM images and movies are read once
+// and shared read-only between them.  A ROM can be given as
+// rom.nes:a.nesm:b.nesm to run it once for each movie, with its input.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "include/console.hpp"
+#include "include/movie.hpp"
+
+namespace {
+
+    struct Rom {
+        std::string name;
+        std::vector<u8> data;
+    };
+
+    struct Input {
+        std::string name;
+        Movie movie;
+    };
+
+    struct Job {
+        const Rom *rom;
+        const Input *input;      // null to run without one
+        int session;
+        std::vector<u64> hashes; // one every `every` frames
+        double seconds;
+        std::string error;       // why it stopped early, empty if it didn't
+        bool otherRom;           // the movie was recorded with a different ROM
+    };
+
+    /**
+     * Each worker has its own queue.  It takes jobs from the front of it
+     * and, once it is empty, steals from the back of the others.  Jobs
+     * never add jobs, so when every queue is empty the worker is done.
+     */
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    bool take_job(std::vector<WorkQueue> &queues, size_t self, size_t &job) {
+        {
+            std::lock_guard<std::mutex> guard(queues[self].lock);
+            if (!queues[self].jobs.empty()) {
+                job = queues[self].jobs.front();
+                queues[self].jobs.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            WorkQueue &victim = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_job(Job &job, long frames, long every, bool jit) {
+        Console *console = new Console();
+        if (!console->load(job.rom->data.data(), job.rom->data.size())) {
+            job.error = "could not be loaded";
+            delete console;
+            return;
+        }
+        console->cpu.set_jit(jit);
+        job.otherRom = job.input && job.input->movie.romHash != console->cartridge.rom_hash();
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 1; i <= frames; i++) {
+            if (job.input) {
+                job.input->movie.play(*console, i - 1);
+            }
+            console->run_frame();
+            // jammed CPUs don't come back, and nothing else in the batch should care
+            if (console->cpu.jammed) {
+                char at[64];
+                snprintf(at, sizeof(at), "CPU jammed at $%04X in frame %ld", console->cpu.PC, i);
+                job.error = at;
+                break;
+            }
+            if (i % every == 0) {
+                job.hashes.push_back(console->frame_hash());
+            }
+        }
+        job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        delete console;
+    }
+
+    bool read_rom(const char *fileName, Rom &rom) {
+        FILE *f = fopen(fileName, "rb");
+        if (f == NULL) {
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        rom.name = fileName;
+        rom.data.resize(size > 0 ? size : 0);
+        bool ok = size > 0 && fread(rom.data.data(), 1, size, f) == (size_t) size;
+        fclose(f);
+        return ok;
+    }
+
+    bool read_list(const char *fileName, std::vector<std::string> &names) {
+        FILE *f = fopen(fileName, "r");
+        if (f == NULL) {
+            return false;
+        }
+        char line[4096];
+        while (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[0] != 0 && line[0] != '#') {
+                names.push_back(line);
+            }
+        }
+        fclose(f);
+        return true;
+    }
+
+    void usage(const char *name) {
+        fprintf(stderr, "usage: %s [rom.nes ...] [-list file] [-frames N] [-every N] [-repeat N] [-threads N] [-jit]\n", name);
+        fprintf(stderr, "  -list file  read more ROM paths from file, one per line\n");
+        fprintf(stderr, "  a ROM given as rom.nes:a.nesm:b.nesm runs once with each movie as its input\n");
+        fprintf(stderr, "  -frames N   frames to run per job (default 600)\n");
+        fprintf(stderr, "  -every N    report a frame hash every N frames (default: last frame only)\n");
+        fprintf(stderr, "  -repeat N   run every ROM N times as separate sessions (default 1)\n");
+        fprintf(stderr, "  -threads N  worker threads (default: one per core)\n");
+        fprintf(stderr, "  -jit        run code from PRG-ROM compiled to native code (x86-64 only)\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> names;
+    long frames = 600;
+    long every = 0;
+    long repeat = 1;
+    long threads = std::thread::hardware_concurrency();
+    bool jit = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-every") && i + 1 < argc) {
+            every = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-repeat") && i + 1 < argc) {
+            repeat = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            threads = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-jit")) {
+            jit = true;
+        } else if (!strcmp(argv[i], "-list") && i + 1 < argc) {
+            if (!read_list(argv[++i], names)) {
+                fprintf(stderr, "could not read %s\n", argv[i]);
+                return 1;
+            }
+        } else if (argv[i][0] != '-') {
+            names.push_back(argv[i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (every == 0) {
+        every = frames;
+    }
+    if (names.empty() || frames < 1 || every < 1 || repeat < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (jit && !Jit::available()) {
+        fprintf(stderr, "no JIT on this machine\n");
+        return 1;
+    }
+
+    // a deque so the jobs can point at them as they are added
+    std::deque<Rom> roms;
+    std::deque<Input> inputs;
+    std::vector<Job> jobs;
+    for (const std::string &name : names) {
+        size_t colon = name.find(':');
+        roms.emplace_back();
+        Rom &rom = roms.back();
+        std::string romName = name.substr(0, colon);
+        if (!read_rom(romName.c_str(), rom)) {
+            fprintf(stderr, "could not read %s\n", romName.c_str());
+            return 1;
+        }
+        std::vector<const Input *> movies;
+        while (colon != std::string::npos) {
+            size_t next = name.find(':', colon + 1);
+            inputs.emplace_back();
+            Input &input = inputs.back();
+            input.name = name.substr(colon + 1, next == std::string::npos ? next : next - colon - 1);
+            if (!input.movie.load(input.name.c_str())) {
+                fprintf(stderr, "%s is not a movie\n", input.name.c_str());
+                return 1;
+            }
+            movies.push_back(&input);
+            colon = next;
+        }
+        if (movies.empty()) {
+            movies.push_back(NULL);
+        }
+        for (const Input *input : movies) {
+            for (int session = 0; session < repeat; session++) {
+                jobs.push_back(Job{&rom, input, session, {}, 0, "", false});
+            }
+        }
+    }
+    if ((size_t) threads > jobs.size()) {
+        threads = jobs.size();
+    }
+
+    std::vector<WorkQueue> queues(threads);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        queues[i % threads].jobs.push_back(i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (long t = 0; t < threads; t++) {
+        workers.emplace_back([&queues, &jobs, t, frames, every, jit] {
+            size_t job;
+            while (take_job(queues, t, job)) {
+                run_job(jobs[job], frames, every, jit);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for (const Job &job : jobs) {
+        std::string jobName = job.rom->name;
+        if (job.input) {
+            jobName += ":" + job.input->name;
+        }
+        const char *name = jobName.c_str();
+        if (job.otherRom) {
+            fprintf(stderr, "warning: %s was recorded with a different ROM\n", job.input->name.c_str());
+        }
+        if (!job.error.empty()) {
+            printf("%s#%d %s\n", name, job.session, job.error.c_str());
+            failed++;
+            continue;
+        }
+        for (size_t i = 0; i < job.hashes.size(); i++) {
+            printf("%s#%d frame %ld %016llx\n", name, job.session, (long) (i + 1) * every,
+                   (unsigned long long) job.hashes[i]);
+        }
+        printf("%s#%d %ld frames in %.3f s, %.1f fps\n", name, job.session, frames, job.seconds,
+               job.seconds > 0 ? frames / job.seconds : 0.0);
+    }
+
+    double total = (double) frames * (jobs.size() - failed);
+    fprintf(stderr, "%zu jobs on %ld threads, %.0f frames in %.3f s, %.1f fps\n",
+            jobs.size() - failed, threads, total, seconds, seconds > 0 ? total / seconds : 0.0);
+    if (failed) {
+        fprintf(stderr, "%d jobs failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
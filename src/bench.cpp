@@ -0,0 +1,400 @@
+//
+// Benchmarks: runs fixed workloads (a ROM, optionally with recorded
+// input) headlessly for a set number of frames and reports frames per
+// second, time per CPU instruction and per PPU dot and how often the
+// emulator allocates, plus micro-benchmarks of the hottest functions.
+// With -json the results are written out for comparing across commits.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "include/console.hpp"
+#include "include/movie.hpp"
+#include "include/trace.hpp"
+
+/*
+ * Every allocation in the program goes through here, so the workloads can
+ * report how many they make once they are running.
+ */
+namespace {
+    u64 allocations = 0;
+    u64 allocatedBytes = 0;
+}
+
+void *operator new(size_t size) {
+    allocations++;
+    allocatedBytes += size;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete[](void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    double since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // results go through here so the compiler can't drop the work
+    volatile u32 sink;
+
+    struct Workload {
+        std::string rom;
+        std::string input;
+        Movie movie;
+    };
+
+    struct Result {
+        double fps;
+        double nsPerInstruction;
+        double nsPerDot;
+        u64 instructions;
+        u64 dots;
+        u64 setupAllocations;
+        u64 runAllocations;
+        u64 runBytes;
+        u64 hash;
+    };
+
+    /**
+     * Best of repeat runs.  Instructions are counted in a separate run with
+     * a trace log, which runs every one of them, so the timed runs do too:
+     * idle loop skipping and fused idioms are off, and ns/instr is the
+     * plain interpreter's, or the JIT's with jit.
+     */
+    Result run_workload(const Workload &w, long frames, int repeat, bool jit) {
+        Result r = {};
+
+        Console *console = new Console();
+        console->load(w.rom.c_str());
+        TraceLog counter(1);
+        console->cpu.set_trace(&counter);
+        for (long i = 0; i < frames; i++) {
+            w.movie.play(*console, i);
+            console->run_frame();
+        }
+        r.instructions = counter.recorded();
+        delete console;
+
+        double best = 0;
+        for (int n = 0; n < repeat; n++) {
+            u64 before = allocations;
+            console = new Console();
+            console->load(w.rom.c_str());
+            console->cpu.set_idle_skip(false);
+            console->cpu.set_fusion(false);
+            console->cpu.set_jit(jit);
+            r.setupAllocations = allocations - before;
+
+            before = allocations;
+            u64 beforeBytes = allocatedBytes;
+            auto start = Clock::now();
+            for (long i = 0; i < frames; i++) {
+                w.movie.play(*console, i);
+                console->run_frame();
+            }
+            double seconds = since(start);
+            r.runAllocations = allocations - before;
+            r.runBytes = allocatedBytes - beforeBytes;
+
+            if (n == 0 || seconds < best) {
+                best = seconds;
+            }
+            r.dots = console->ppu.clock;
+            r.hash = console->frame_hash();
+            delete console;
+        }
+        r.fps = frames / best;
+        r.nsPerInstruction = r.instructions ? best * 1e9 / r.instructions : 0;
+        r.nsPerDot = r.dots ? best * 1e9 / r.dots : 0;
+        return r;
+    }
+
+    /*
+     * Micro-benchmarks.  They run on made up cartridges so they don't
+     * depend on the workloads: NROM for the CPU and PPU, and 128KB of MMC1
+     * PRG with the bank registers switched as it goes.
+     */
+    std::vector<u8> make_rom(int mapper, int prgBanks) {
+        std::vector<u8> rom(16 + prgBanks * 0x4000 + 0x2000);
+        memcpy(rom.data(), "NES\x1A", 4);
+        rom[4] = prgBanks;
+        rom[5] = 1;
+        rom[6] = mapper << 4;
+        u32 seed = 1;
+        for (size_t i = 16; i < rom.size(); i++) {
+            seed = seed * 1103515245 + 12345;
+            rom[i] = seed >> 16;
+        }
+        // reset vector to a JMP to itself at $8000
+        u8 *last = &rom[16 + (prgBanks - 1) * 0x4000];
+        u8 *first = &rom[16];
+        first[0] = 0x4C;
+        first[1] = 0x00;
+        first[2] = 0x80;
+        last[0x3FFC] = 0x00;
+        last[0x3FFD] = 0x80;
+        return rom;
+    }
+
+    std::vector<u16> random_addresses(size_t n, u32 seed, const u16 *ranges, int count) {
+        std::vector<u16> out(n);
+        for (size_t i = 0; i < n; i++) {
+            seed = seed * 1103515245 + 12345;
+            int r = (seed >> 8) % count;
+            seed = seed * 1103515245 + 12345;
+            out[i] = ranges[r * 2] + (seed >> 8) % (ranges[r * 2 + 1] - ranges[r * 2]);
+        }
+        return out;
+    }
+}
+
+struct Bench {
+
+    struct Micro {
+        const char *name;
+        double ns;
+    };
+
+    //ns per call of f(i) over iterations calls, best of three
+    template<typename F>
+    static double time(long iterations, F f) {
+        double best = 0;
+        for (int n = 0; n < 3; n++) {
+            auto start = Clock::now();
+            for (long i = 0; i < iterations; i++) {
+                f(i);
+            }
+            double seconds = since(start);
+            if (n == 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+        return best * 1e9 / iterations;
+    }
+
+    //reads spread over RAM, PRG RAM and PRG-ROM, the places code reads most
+    static double cpu_access(Console &console, long iterations) {
+        static const u16 ranges[] = {0x0000, 0x0800, 0x0800, 0x2000, 0x6000, 0x8000, 0x8000, 0xFFFF};
+        std::vector<u16> addrs = random_addresses(4096, 7, ranges, 4);
+        CPU &cpu = console.cpu;
+        u32 sum = 0;
+        double ns = time(iterations, [&](long i) {
+            sum += cpu.access<false>(addrs[i & 4095]);
+        });
+        sink = sum;
+        return ns;
+    }
+
+    //one visible scanline of pixels at a time, background and sprites on
+    static double ppu_write_pixel(Console &console, long iterations) {
+        PPU &ppu = console.ppu;
+        ppu.ppuMask = 0x1E;
+        ppu.scanline = 100;
+        double ns = time(iterations, [&](long i) {
+            ppu.cycle = 1 + i % 256;
+            ppu.writePixel();
+        });
+        sink = ppu.frame()[0];
+        return ns;
+    }
+
+    //sprite evaluation for the first 256 dots of a line, with a full OAM
+    static double ppu_evaluate_sprites(Console &console, long iterations) {
+        PPU &ppu = console.ppu;
+        for (int i = 0; i < 256; i++) {
+            ppu.OAM[i] = i * 37 + 11;
+        }
+        ppu.scanline = 100;
+        double ns = time(iterations, [&](long i) {
+            ppu.cycle = 1 + i % 256;
+            ppu.evaluateSprites();
+        });
+        sink = ppu.secondaryOamBuffer[0];
+        return ns;
+    }
+
+    //reads through Mapper1, switching the PRG bank every 256 of them
+    static double mapper1_read(Console &console, long iterations) {
+        static const u16 ranges[] = {0x6000, 0x8000, 0x8000, 0xFFFF};
+        std::vector<u16> addrs = random_addresses(4096, 11, ranges, 2);
+        Mapper &mapper = *console.cartridge.mapper;
+        u32 sum = 0;
+        double ns = time(iterations, [&](long i) {
+            if ((i & 255) == 0) {
+                u8 bank = i >> 8;
+                for (int bit = 0; bit < 5; bit++) {
+                    mapper.write(0xE000, bank >> bit);
+                }
+            }
+            sum += mapper.read(addrs[i & 4095]);
+        });
+        sink = sum;
+        return ns;
+    }
+
+    static std::vector<Micro> run_micro(long iterations) {
+        std::vector<Micro> out;
+        std::vector<u8> nrom = make_rom(0, 2);
+        std::vector<u8> mmc1 = make_rom(1, 8);
+        Console *console = new Console();
+        console->load(nrom.data(), nrom.size());
+        out.push_back({"CPU::access", cpu_access(*console, iterations)});
+        out.push_back({"PPU::writePixel", ppu_write_pixel(*console, iterations)});
+        out.push_back({"PPU::evaluateSprites", ppu_evaluate_sprites(*console, iterations)});
+        delete console;
+        console = new Console();
+        console->load(mmc1.data(), mmc1.size());
+        out.push_back({"Mapper1::read", mapper1_read(*console, iterations)});
+        delete console;
+        return out;
+    }
+};
+
+namespace {
+
+    //JSON strings here are file names, escape what JSON needs escaping
+    std::string quote(const std::string &s) {
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    void usage(const char *name) {
+        fprintf(stderr, "usage: %s [-frames N] [-repeat N] [-micro N] [-jit] [-json file] rom.nes[:input] ...\n", name);
+        fprintf(stderr, "  -frames N  frames per workload (default 1200)\n");
+        fprintf(stderr, "  -repeat N  timed runs per workload, the best counts (default 3)\n");
+        fprintf(stderr, "  -micro N   iterations of each micro-benchmark, 0 for none (default 20000000)\n");
+        fprintf(stderr, "  -jit       time the workloads with the JIT (x86-64 only)\n");
+        fprintf(stderr, "  -json file write the results as JSON, - for stdout\n");
+        fprintf(stderr, "  input is a movie recorded with -record\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long frames = 1200;
+    int repeat = 3;
+    long micro = 20000000;
+    const char *jsonName = NULL;
+    bool jit = false;
+    std::vector<Workload> workloads;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-repeat") && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-micro") && i + 1 < argc) {
+            micro = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-jit")) {
+            jit = true;
+        } else if (!strcmp(argv[i], "-json") && i + 1 < argc) {
+            jsonName = argv[++i];
+        } else if (argv[i][0] != '-') {
+            Workload w;
+            w.rom = argv[i];
+            size_t colon = w.rom.find(':');
+            if (colon != std::string::npos) {
+                w.input = w.rom.substr(colon + 1);
+                w.rom.resize(colon);
+                if (!w.movie.load(w.input.c_str())) {
+                    fprintf(stderr, "%s is not a movie\n", w.input.c_str());
+                    return 1;
+                }
+            }
+            workloads.push_back(w);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 1 || repeat < 1 || micro < 0 || (workloads.empty() && micro == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (jit && !Jit::available()) {
+        fprintf(stderr, "no JIT on this machine\n");
+        return 1;
+    }
+
+    // a ROM that can't be run stops us here, not half way through the timings
+    for (const Workload &w : workloads) {
+        Console *console = new Console();
+        bool ok = console->load(w.rom.c_str());
+        delete console;
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    for (const Workload &w : workloads) {
+        Result r = run_workload(w, frames, repeat, jit);
+        results.push_back(r);
+        printf("%-32s %8.1f fps %7.2f ns/instr %6.2f ns/dot  %llu allocations running, %llu setting up\n",
+               w.rom.c_str(), r.fps, r.nsPerInstruction, r.nsPerDot,
+               (unsigned long long) r.runAllocations, (unsigned long long) r.setupAllocations);
+    }
+    std::vector<Bench::Micro> micros;
+    if (micro > 0) {
+        micros = Bench::run_micro(micro);
+        for (const Bench::Micro &m : micros) {
+            printf("%-32s %8.2f ns/call\n", m.name, m.ns);
+        }
+    }
+
+    if (jsonName) {
+        FILE *f = strcmp(jsonName, "-") ? fopen(jsonName, "w") : stdout;
+        if (f == NULL) {
+            fprintf(stderr, "could not write %s\n", jsonName);
+            return 1;
+        }
+        fprintf(f, "{\n  \"frames\": %ld,\n  \"repeat\": %d,\n  \"jit\": %s,\n  \"workloads\": [", frames, repeat,
+                jit ? "true" : "false");
+        for (size_t i = 0; i < workloads.size(); i++) {
+            const Result &r = results[i];
+            fprintf(f, "%s\n    {\"rom\": %s, \"input\": %s, \"fps\": %.2f, \"ns_per_instruction\": %.3f, "
+                       "\"ns_per_dot\": %.3f, \"instructions\": %llu, \"dots\": %llu, "
+                       "\"allocations\": %llu, \"allocated_bytes\": %llu, \"setup_allocations\": %llu, "
+                       "\"frame_hash\": \"%016llx\"}",
+                    i ? "," : "", quote(workloads[i].rom).c_str(), quote(workloads[i].input).c_str(),
+                    r.fps, r.nsPerInstruction, r.nsPerDot, (unsigned long long) r.instructions,
+                    (unsigned long long) r.dots, (unsigned long long) r.runAllocations,
+                    (unsigned long long) r.runBytes, (unsigned long long) r.setupAllocations,
+                    (unsigned long long) r.hash);
+        }
+        fprintf(f, "\n  ],\n  \"micro\": {");
+        for (size_t i = 0; i < micros.size(); i++) {
+            fprintf(f, "%s\n    %s: %.3f", i ? "," : "", quote(micros[i].name).c_str(), micros[i].ns);
+        }
+        fprintf(f, "\n  }\n}\n");
+        if (f != stdout) {
+            fclose(f);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <cmath>
+#include <cstring>
+#include "include/blip.hpp"
+
+/*
+ * The kernel adds are where the time goes, 16 multiply-adds per change.
+ * Pick the widest vectors the build targets, -mavx (or -march=native)
+ * for 8 floats at a time, x86-64 always has SSE2 for 4.
+ */
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+    const int PHASE_BITS = 6;
+    const int PHASES = 1 << PHASE_BITS;
+
+    /**
+     * One impulse per sub-sample phase: a Blackman windowed sinc with
+     * its cutoff a bit under the output Nyquist, each phase scaled to sum
+     * to exactly 1 so steps settle at the right level.
+     */
+    struct Kernel {
+        alignas(32) float taps[PHASES][BlipBuffer::TAPS];
+
+        Kernel() {
+            const double cutoff = 0.9;
+            const double half = BlipBuffer::TAPS / 2;
+            for (int p = 0; p < PHASES; p++) {
+                double total = 0;
+                double h[BlipBuffer::TAPS];
+                for (int k = 0; k < BlipBuffer::TAPS; k++) {
+                    double x = k + 1 - half - (double) p / PHASES;
+                    double s = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+                    double w = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half);
+                    h[k] = s * w;
+                    total += h[k];
+                }
+                for (int k = 0; k < BlipBuffer::TAPS; k++) {
+                    taps[p][k] = h[k] / total;
+                }
+            }
+        }
+    };
+
+    const Kernel kernel;
+
+    //console's own high pass is around 90Hz
+    const double HIGH_PASS_HZ = 90;
+}
+
+BlipBuffer::BlipBuffer() {
+    clear();
+}
+
+void BlipBuffer::set_rates(double clockRate, double sampleRate) {
+    factor = (u64) (sampleRate / clockRate * ((u64) 1 << FRAC_BITS));
+    pole = (float) exp(-2 * M_PI * HIGH_PASS_HZ / sampleRate);
+}
+
+void BlipBuffer::clear() {
+    pos &= ((u64) 1 << FRAC_BITS) - 1;
+    sum = 0;
+    memset(buffer, 0, sizeof(buffer));
+}
+
+void BlipBuffer::add_delta(float delta) {
+    float *out = buffer + (pos >> FRAC_BITS);
+    const float *k = kernel.taps[(pos >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+#if defined(__AVX__)
+    __m256 d = _mm256_set1_ps(delta);
+    for (int i = 0; i < TAPS; i += 8) {
+        __m256 o = _mm256_loadu_ps(out + i);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(o, _mm256_mul_ps(d, _mm256_load_ps(k + i))));
+    }
+#elif defined(__SSE2__)
+    __m128 d = _mm_set1_ps(delta);
+    for (int i = 0; i < TAPS; i += 4) {
+        __m128 o = _mm_loadu_ps(out + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(o, _mm_mul_ps(d, _mm_load_ps(k + i))));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t d = vdupq_n_f32(delta);
+    for (int i = 0; i < TAPS; i += 4) {
+        vst1q_f32(out + i, vmlaq_f32(vld1q_f32(out + i), d, vld1q_f32(k + i)));
+    }
+#else
+    for (int i = 0; i < TAPS; i++) {
+        out[i] += delta * k[i];
+    }
+#endif
+}
+
+/*
+ * The integrator is a chain through every sample so it stays scalar, it
+ * leaves the scaled samples in place for a vector pass to round and
+ * saturate them to 16 bits.
+ */
+int BlipBuffer::read(s16 *out, int max) {
+    int n = available();
+    if (n > max) {
+        n = max;
+    }
+    for (int i = 0; i < n; i++) {
+        sum = sum * pole + buffer[i];
+        buffer[i] = sum * 32767.0f;
+    }
+    // left alone a silent integrator decays into denormals, which are slow
+    if (fabsf(sum) < 1e-9f) {
+        sum = 0;
+    }
+
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_cvtps_epi32(_mm_loadu_ps(buffer + i));
+        __m128i b = _mm_cvtps_epi32(_mm_loadu_ps(buffer + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(a, b));
+    }
+#elif defined(__ARM_NEON) && defined(__ARM_FEATURE_DIRECTED_ROUNDING)
+    // vrndnq is ARMv8, 32 bit NEON builds round below like anywhere else
+    for (; i + 4 <= n; i += 4) {
+        vst1_s16(out + i, vqmovn_s32(vcvtq_s32_f32(vrndnq_f32(vld1q_f32(buffer + i)))));
+    }
+#endif
+    for (; i < n; i++) {
+        long s = lrintf(buffer[i]);
+        out[i] = (s16) (s > 32767 ? 32767 : s < -32768 ? -32768 : s);
+    }
+
+    // the rest, and what the last impulses wrote past it, moves to the front
+    int left = available() - n + TAPS;
+    memmove(buffer, buffer + n, left * sizeof(float));
+    memset(buffer + left, 0, n * sizeof(float));
+    pos -= (u64) n << FRAC_BITS;
+    return n;
+}
@@ -1,103 +1,139 @@
 #include <cstdio>
-#include <cstdlib>
-#include <iostream>
+#include <cstring>
 
 #include "include/cartridge.hpp"
+#include "include/console.hpp"
 #include "include/cpu.hpp"
 #include "include/mapper.hpp"
 #include "include/mappers/mapper0.hpp"
 #include "include/mappers/mapper1.hpp"
 #include "include/ppu.hpp"
 
-namespace Cartridge {
+Cartridge::Cartridge(Console &console) : cpu(console.cpu), ppu(console.ppu), apu(console.apu) {}
 
-    Mapper *mapper;
-//Mapper will be include here to handle memory access
+Cartridge::~Cartridge() {
+    delete mapper;
+    delete[] image;
+}
 
 //access PRG ROM/RAM using mapper
-    template<bool wr>
-    u8 access(u16 addr, u8 v) {
-        //TODO mapper access
-        if (!wr) {
-            return mapper->read(addr);
-        } else {
-            return mapper->write(addr, v);
-        }
+template<bool wr>
+u8 Cartridge::access(u16 addr, u8 v) {
+    //TODO mapper access
+    if (!wr) {
+        return mapper->read(addr);
+    } else {
+        return mapper->write(addr, v);
+    }
+}
+
+template<bool wr>
+u8 Cartridge::chr_access(u16 addr, u8 v) {
+    //TODO mapper access
+    if (!wr) {
+        return mapper->chr_read(addr);
+    } else {
+        mapper->chr_written(addr);
+        return mapper->chr_write(addr, v);
+    }
+    return 0;
+}
+
+bool Cartridge::load(const char *fileName) {
+    //Open to read binary file with ROM in it
+    FILE *f = fopen(fileName, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: file error\n", fileName);
+        return false;
+    }
+
+    //jump to end of file, and get size, then go to start
+    fseek(f, 0, SEEK_END);
+    int size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    u8 *rom = new u8[size];
+
+    int result = fread(rom, 1, size, f);
+    fclose(f);
+    if (result != size) {
+        fprintf(stderr, "%s: reading error\n", fileName);
+        delete[] rom;
+        return false;
     }
 
-    template<bool wr>
-    u8 chr_access(u16 addr, u8 v) {
-        //TODO mapper access
-        if (!wr) {
-            return mapper->chr_read(addr);
-        } else {
-            return mapper->chr_write(addr, v);
-        }
-        return 0;
+    if (!load(rom, size)) {
+        delete[] rom;
+        return false;
+    }
+    delete[] image;
+    image = rom;
+    return true;
+}
+
+bool Cartridge::load(const u8 *rom, size_t size) {
+    if (size < 16 || memcmp(rom, "NES\x1A", 4) != 0) {
+        fputs("not an iNES ROM\n", stderr);
+        return false;
+    }
+    // the mappers take the banks the header promises straight from the image
+    size_t prgSize = rom[4] * 0x4000, chrSize = rom[5] * 0x2000;
+    if (prgSize == 0 || size < 16 + prgSize + chrSize) {
+        fprintf(stderr, "ROM image is %zu bytes, the header needs %zu\n", size, 16 + prgSize + chrSize);
+        return false;
+    }
+    u8 mapperID = (rom[7] & 0xF0) + (rom[6] >> 4);
+    if (mapperID > 1) {
+        fprintf(stderr, "mapper %d is not supported\n", mapperID);
+        return false;
     }
 
-    void load(const char *fileName) {
-        //Open to read binary file with ROM in it
-        FILE *f = fopen(fileName, "rb");
-        if (f == NULL) {
-            fputs(fileName, stderr);
-            fputs("File error", stderr);
-            exit(1);
-        }
-
-        //jump to end of file, and get size, then go to start
-        fseek(f, 0, SEEK_END);
-        int size = ftell(f);
-        fseek(f, 0, SEEK_SET);
-
-        u8 *rom = new u8[size];
-
-        int result = fread(rom, 1, size, f);
-        if (result != size) {
-            fputs("reading error", stderr);
-            exit(2);
-        }
-        fclose(f);
-
-        //Find Mapper
-        u8 mapperID = (rom[7] & 0xF0) + (rom[6] >> 4);
-        u8 nametableMirroring = rom[6] & 0x1;
-        PPU::Mirroring mirroringType = nametableMirroring ? PPU::vertical : PPU::horizontal;
-
-        if (mirroringType == PPU::vertical) {
-            printf("vertical");
-        } else {
-            printf("horizontal");
-        }
-
-
-        std::cout << (int) mapperID << std::endl;
-
-        switch (mapperID) {
-            case 0:
-                mapper = new Mapper0(rom);
-                break;
-            case 1:
-                mapper = new Mapper1(rom);
-                break;
-        }
-        //
-
-        //Start running the ROM file
-        CPU::power();
-        PPU::power();
-        PPU::set_mirroring(mirroringType);
-        //TODO:  PPU start
+    romHash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        romHash ^= rom[i];
+        romHash *= 0x100000001b3ULL;
     }
 
-    bool loaded() {
-        //TODO: check if it is loaded into proper mapper
-        return true;
+    //Find Mapper
+    u8 nametableMirroring = rom[6] & 0x1;
+    PPU::Mirroring mirroringType = nametableMirroring ? PPU::vertical : PPU::horizontal;
+
+    if (mirroringType == PPU::vertical) {
+        fprintf(stderr, "vertical");
+    } else {
+        fprintf(stderr, "horizontal");
     }
 
-    template u8 access<true>(u16, u8);
-    template u8 access<false>(u16, u8);
 
-    template u8 chr_access<true>(u16, u8);
-    template u8 chr_access<false>(u16, u8);
-} // namespace Cartridge
+    fprintf(stderr, "%d\n", mapperID);
+
+    delete mapper;
+    switch (mapperID) {
+        case 0:
+            mapper = new Mapper0(rom, ppu);
+            break;
+        default:
+            mapper = new Mapper1(rom, ppu);
+            break;
+    }
+    //
+
+    //Start running the ROM file
+    cpu.power();
+    ppu.power();
+    apu.power();
+    ppu.set_mirroring(mirroringType);
+    //TODO:  PPU start
+    return true;
+}
+
+bool Cartridge::loaded() {
+    //TODO: check if it is loaded into proper mapper
+    return true;
+}
+
+template u8 Cartridge::access<true>(u16, u8);
+template u8 Cartridge::access<false>(u16, u8);
+
+template u8 Cartridge::chr_access<true>(u16, u8);
+template u8 Cartridge::chr_access<false>(u16, u8);
@@ -0,0 +1,347 @@
+//
+// Conformance runner: runs CPU/PPU test ROMs headlessly and checks them
+// against known results, one PASS/FAIL line per ROM.  Two kinds of check:
+//
+//   trace ROM LOG [START]  every instruction against a nestest.log style
+//                          LOG, starting at START (hex) instead of the
+//                          reset vector if given, e.g. C000 for nestest
+//   status ROM [FRAMES]    the result the ROM writes to $6000, the way
+//                          blargg's test ROMs report, within FRAMES
+//                          frames (default 3600)
+//
+// Checks come from list files, one per line, paths relative to the list.
+// Status checks run the way the emulator does, idle loop skipping and
+// fused idioms on and the JIT with -jit, so the same list checks every
+// mode.  Trace checks see every instruction and so always run the plain
+// interpreter.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "include/console.hpp"
+#include "include/trace.hpp"
+
+namespace {
+
+    struct Result {
+        bool pass;
+        bool stuck; // no result in time
+        std::string detail;
+        u64 instructions; // traced checks only
+        u64 cycles;
+        double seconds;
+    };
+
+    //how the CPU runs the ROMs, the same for every check
+    struct Modes {
+        bool jit = false;
+        bool idleSkip = true;
+        bool fusion = true;
+    };
+
+    //a console with romName loaded and set up for modes, NULL with the reason in result if not
+    Console *power_on(const char *romName, const Modes &modes, Result &result) {
+        Console *console = new Console();
+        if (!console->load(romName)) {
+            delete console;
+            result.detail = std::string("could not load ") + romName;
+            return NULL;
+        }
+        console->cpu.set_idle_skip(modes.idleSkip);
+        console->cpu.set_fusion(modes.fusion);
+        if (modes.jit && !console->cpu.set_jit(true)) {
+            delete console;
+            result.detail = "no JIT on this machine";
+            return NULL;
+        }
+        return console;
+    }
+
+    //what a line of a nestest.log says about the CPU before an instruction
+    struct Expected {
+        u16 pc;
+        int length;
+        u8 bytes[3];
+        u8 a, x, y, p, s;
+        bool hasCycles;
+        u64 cycles;
+    };
+
+    bool parse(const char *line, Expected &e) {
+        char *end;
+        e.pc = strtoul(line, &end, 16);
+        if (end != line + 4) {
+            return false;
+        }
+        // up to three bytes from column 6, the disassembly starts at 16
+        e.length = 0;
+        for (const char *b = line + 6; e.length < 3 && b + 2 <= line + 14 && b[0] != ' '; b += 3) {
+            e.bytes[e.length++] = strtoul(std::string(b, 2).c_str(), NULL, 16);
+        }
+        const char *regs = strstr(line, "A:");
+        unsigned a, x, y, p, s;
+        if (e.length == 0 || regs == NULL ||
+            sscanf(regs, "A:%x X:%x Y:%x P:%x SP:%x", &a, &x, &y, &p, &s) != 5) {
+            return false;
+        }
+        e.a = a;
+        e.x = x;
+        e.y = y;
+        e.p = p;
+        e.s = s;
+        // older logs have CYC as the PPU dot, only the ones with PPU: count CPU cycles
+        const char *cyc = strstr(regs, "CYC:");
+        e.hasCycles = strstr(regs, "PPU:") != NULL && cyc != NULL;
+        e.cycles = e.hasCycles ? strtoull(cyc + 4, NULL, 10) : 0;
+        return true;
+    }
+
+    bool matches(const Expected &e, const TraceRecord &r) {
+        if (e.pc != r.pc || memcmp(e.bytes, r.bytes, e.length) ||
+            e.a != r.a || e.x != r.x || e.y != r.y || e.p != r.p || e.s != r.s) {
+            return false;
+        }
+        return !e.hasCycles || e.cycles == r.cycles;
+    }
+
+    std::string jammed_at(const CPU &cpu) {
+        char at[32];
+        snprintf(at, sizeof(at), "CPU jammed at $%04X", cpu.PC);
+        return at;
+    }
+
+    Result run_trace(const char *romName, const char *logName, const char *start, const Modes &modes) {
+        Result result = {false, false, "", 0, 0, 0};
+        FILE *log = fopen(logName, "r");
+        if (log == NULL) {
+            result.detail = std::string("could not read ") + logName;
+            return result;
+        }
+        Console *console = power_on(romName, modes, result);
+        if (console == NULL) {
+            fclose(log);
+            return result;
+        }
+        if (start) {
+            console->cpu.PC = strtoul(start, NULL, 16);
+        }
+        TraceLog trace(1 << 16);
+        console->cpu.set_trace(&trace);
+
+        char line[256];
+        long lineNumber = 0;
+        bool done = false;
+        auto began = std::chrono::steady_clock::now();
+        // a frame at a time, then check what it ran against the log
+        for (int frame = 0; !done && frame < 36000; frame++) {
+            console->run_frame();
+            for (size_t i = 0; i < trace.held(); i++) {
+                if (fgets(line, sizeof(line), log) == NULL) {
+                    result.pass = true;
+                    done = true;
+                    break;
+                }
+                lineNumber++;
+                line[strcspn(line, "\r\n")] = 0;
+                Expected e;
+                if (!parse(line, e)) {
+                    result.detail = "line " + std::to_string(lineNumber) + " of the log doesn't parse";
+                    done = true;
+                    break;
+                }
+                if (!matches(e, trace.held(i))) {
+                    char got[128];
+                    TraceLog::format(trace.held(i), got, sizeof(got));
+                    result.detail = "differs at line " + std::to_string(lineNumber) +
+                                    "\n    expected " + line + "\n    got      " + got;
+                    done = true;
+                    break;
+                }
+            }
+            trace.clear();
+            if (console->cpu.jammed) {
+                break;
+            }
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        result.instructions = trace.recorded();
+        result.cycles = console->cpu.cycles;
+        if (!done) {
+            result.stuck = true;
+            result.detail = console->cpu.jammed ? jammed_at(console->cpu) + " after " + std::to_string(lineNumber) + " lines"
+                                                : "still going after " + std::to_string(lineNumber) + " lines";
+        }
+        fclose(log);
+        delete console;
+        return result;
+    }
+
+    /**
+     * run a status check, with trace attached if not null, which keeps the
+     * CPU to the plain interpreter
+     */
+    Result run_status(const char *romName, long frames, const Modes &modes, TraceLog *trace) {
+        Result result = {false, false, "", 0, 0, 0};
+        Console *console = power_on(romName, modes, result);
+        if (console == NULL) {
+            return result;
+        }
+        console->cpu.set_trace(trace);
+        Cartridge &cart = console->cartridge;
+
+        auto began = std::chrono::steady_clock::now();
+        bool done = false;
+        for (long frame = 0; !done && frame < frames; frame++) {
+            console->run_frame();
+            // $6001-$6003 hold DE B0 61 once $6000 is a status, 80 while running
+            u8 status = cart.access<false>(0x6000);
+            if (cart.access<false>(0x6001) != 0xDE || cart.access<false>(0x6002) != 0xB0 ||
+                cart.access<false>(0x6003) != 0x61 || status == 0x80) {
+                // a jammed CPU won't be writing one
+                if (console->cpu.jammed) {
+                    break;
+                }
+                continue;
+            }
+            done = true;
+            if (status == 0x81) {
+                result.detail = "asks for a reset, which the runner can't do";
+                break;
+            }
+            result.pass = status == 0;
+            char code[32];
+            snprintf(code, sizeof(code), "status %02X", status);
+            result.detail = code;
+            // and whatever it has to say, from $6004 on
+            std::string text;
+            for (u16 a = 0x6004; a < 0x8000; a++) {
+                u8 c = cart.access<false>(a);
+                if (c == 0) {
+                    break;
+                }
+                text += c == '\n' ? ' ' : (char) c;
+            }
+            if (!text.empty()) {
+                result.detail += ": " + text;
+            }
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        result.instructions = trace ? trace->recorded() : 0;
+        result.cycles = console->cpu.cycles;
+        if (!done) {
+            result.stuck = true;
+            result.detail = console->cpu.jammed ? jammed_at(console->cpu)
+                                                : "no result after " + std::to_string(frames) + " frames";
+        }
+        delete console;
+        return result;
+    }
+
+    /**
+     * a status check run untraced in modes, and if it gets stuck run
+     * again with the last instructions traced to show where
+     */
+    Result check_status(const char *romName, long frames, const Modes &modes) {
+        Result result = run_status(romName, frames, modes, NULL);
+        if (!result.stuck) {
+            return result;
+        }
+        TraceLog trace(8);
+        Result traced = run_status(romName, frames, modes, &trace);
+        if (!traced.stuck) {
+            // only the interpreter on its own gets there
+            result.detail += ", the plain interpreter gets " + traced.detail;
+            return result;
+        }
+        result.detail += ", stopped at";
+        for (size_t i = 0; i < trace.held(); i++) {
+            char at[128];
+            TraceLog::format(trace.held(i), at, sizeof(at));
+            result.detail += std::string("\n    ") + at;
+        }
+        return result;
+    }
+
+    void usage(const char *name) {
+        fprintf(stderr, "usage: %s [-jit] [-no-idle] [-no-fuse] list...\n", name);
+        fprintf(stderr, "  -jit      run status checks with the JIT (x86-64 only)\n");
+        fprintf(stderr, "  -no-idle  run idle loops instruction by instruction instead of skipping them\n");
+        fprintf(stderr, "  -no-fuse  run the idioms the CPU fuses one instruction at a time\n");
+        fprintf(stderr, "  each line of a list is a check, paths relative to the list:\n");
+        fprintf(stderr, "    trace ROM LOG [START]  compare every instruction with a nestest.log style LOG,\n");
+        fprintf(stderr, "                           starting at START (hex) instead of the reset vector\n");
+        fprintf(stderr, "    status ROM [FRAMES]    wait for the result at $6000 (default 3600 frames)\n");
+        fprintf(stderr, "  blank lines and lines starting with # are skipped, trace checks always run\n");
+        fprintf(stderr, "  the plain interpreter\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Modes modes;
+    int l = 1;
+    for (; l < argc && argv[l][0] == '-'; l++) {
+        if (!strcmp(argv[l], "-jit")) {
+            modes.jit = true;
+        } else if (!strcmp(argv[l], "-no-idle")) {
+            modes.idleSkip = false;
+        } else if (!strcmp(argv[l], "-no-fuse")) {
+            modes.fusion = false;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (l == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    int passed = 0, failed = 0;
+    for (; l < argc; l++) {
+        FILE *list = fopen(argv[l], "r");
+        if (list == NULL) {
+            fprintf(stderr, "could not read %s\n", argv[l]);
+            return 1;
+        }
+        std::string dir = argv[l];
+        size_t slash = dir.rfind('/');
+        dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+
+        char line[1024];
+        while (fgets(line, sizeof(line), list)) {
+            char kind[16], rom[512], arg[512], start[16];
+            int fields = sscanf(line, "%15s %511s %511s %15s", kind, rom, arg, start);
+            if (fields < 1 || kind[0] == '#') {
+                continue;
+            }
+            std::string romPath = rom[0] == '/' ? rom : dir + rom;
+            Result result;
+            if (!strcmp(kind, "trace") && fields >= 3) {
+                std::string logPath = arg[0] == '/' ? arg : dir + arg;
+                result = run_trace(romPath.c_str(), logPath.c_str(), fields == 4 ? start : NULL, modes);
+            } else if (!strcmp(kind, "status") && fields >= 2) {
+                result = check_status(romPath.c_str(), fields >= 3 ? atol(arg) : 3600, modes);
+            } else {
+                fprintf(stderr, "%s: can't make sense of: %s", argv[l], line);
+                return 1;
+            }
+
+            (result.pass ? passed : failed)++;
+            // untraced checks don't count instructions, only cycles
+            bool counted = result.instructions > 0;
+            u64 count = counted ? result.instructions : result.cycles;
+            printf("%s  %s  %llu %s, %.2f M %s/s\n", result.pass ? "PASS" : "FAIL", rom,
+                   (unsigned long long) count, counted ? "instructions" : "cycles",
+                   result.seconds > 0 ? count / result.seconds / 1e6 : 0.0, counted ? "instr" : "cycles");
+            if (!result.pass || !result.detail.empty()) {
+                printf("    %s\n", result.detail.c_str());
+            }
+            fflush(stdout);
+        }
+        fclose(list);
+    }
+    printf("%d passed, %d failed\n", passed, failed);
+    return failed == 0 ? 0 : 1;
+}
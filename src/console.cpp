@@ -0,0 +1,104 @@
+#include <cstring>
+#include <type_traits>
+#include "include/console.hpp"
+
+namespace {
+
+    struct StateHeader {
+        char magic[4];
+        u32 version;
+        u32 size;
+    };
+
+    const char STATE_MAGIC[4] = {'N', 'E', 'S', 'S'};
+
+    const size_t CPU_OFFSET = sizeof(StateHeader);
+    const size_t PPU_OFFSET = CPU_OFFSET + sizeof(CPUState);
+    const size_t APU_OFFSET = PPU_OFFSET + sizeof(PPUState);
+    const size_t CONTROLLER_OFFSET = APU_OFFSET + sizeof(APUState);
+    const size_t MAPPER_OFFSET = CONTROLLER_OFFSET + sizeof(ControllerState);
+
+    static_assert(std::is_trivially_copyable<CPUState>::value, "CPUState is copied as bytes");
+    static_assert(std::is_trivially_copyable<PPUState>::value, "PPUState is copied as bytes");
+    static_assert(std::is_trivially_copyable<APUState>::value, "APUState is copied as bytes");
+    static_assert(std::is_trivially_copyable<ControllerState>::value, "ControllerState is copied as bytes");
+}
+
+Console::Console() : cpu(*this), ppu(*this), apu(*this), cartridge(*this) {}
+
+bool Console::load(const char *fileName) {
+    return cartridge.load(fileName);
+}
+
+bool Console::load(const u8 *rom, size_t size) {
+    return cartridge.load(rom, size);
+}
+
+void Console::run_frame() {
+    cpu.run_frame();
+    // hand over the frame's samples now rather than at the next register write
+    apu.sync();
+}
+
+void Console::run_frame_ahead(int frames) {
+    if (frames <= 0) {
+        run_frame();
+        return;
+    }
+    ppu.set_video(false);
+    run_frame();
+    aheadState.resize(state_size());
+    save_state(aheadState.data());
+    apu.set_audio(false);
+    for (int i = 0; i < frames; i++) {
+        ppu.set_video(i == frames - 1);
+        run_frame();
+    }
+    apu.set_audio(true);
+    load_state(aheadState.data(), aheadState.size());
+}
+
+u64 Console::frame_hash() const {
+    const u32 *pixels = frame();
+    u64 hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 256 * 240; i++) {
+        hash ^= pixels[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+size_t Console::state_size() const {
+    return MAPPER_OFFSET + cartridge.mapper->state_size();
+}
+
+void Console::save_state(u8 *out) const {
+    StateHeader header;
+    memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    header.version = STATE_VERSION;
+    header.size = state_size();
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + CPU_OFFSET, static_cast<const CPUState *>(&cpu), sizeof(CPUState));
+    memcpy(out + PPU_OFFSET, static_cast<const PPUState *>(&ppu), sizeof(PPUState));
+    memcpy(out + APU_OFFSET, static_cast<const APUState *>(&apu), sizeof(APUState));
+    memcpy(out + CONTROLLER_OFFSET, static_cast<const ControllerState *>(&controller), sizeof(ControllerState));
+    cartridge.mapper->save_state(out + MAPPER_OFFSET);
+}
+
+bool Console::load_state(const u8 *in, size_t size) {
+    StateHeader header;
+    if (size != state_size()) {
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (memcmp(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0
+        || header.version != STATE_VERSION || header.size != size) {
+        return false;
+    }
+    memcpy(static_cast<CPUState *>(&cpu), in + CPU_OFFSET, sizeof(CPUState));
+    memcpy(static_cast<PPUState *>(&ppu), in + PPU_OFFSET, sizeof(PPUState));
+    memcpy(static_cast<APUState *>(&apu), in + APU_OFFSET, sizeof(APUState));
+    memcpy(static_cast<ControllerState *>(&controller), in + CONTROLLER_OFFSET, sizeof(ControllerState));
+    cartridge.mapper->load_state(in + MAPPER_OFFSET);
+    return true;
+}
@@ -3,35 +3,38 @@
 //
 #include <stdio.h>
 #include <iostream>
-#include "include/gui.hpp"
+#include "include/controller.hpp"
 
-namespace Controller {
-
-   GUI::controller_status controller1_status;
-   bool strobe = false;
-   int counter = 0;
-
-   void setControllerStatus(bool setStrobe) {
-       strobe = setStrobe;
-       if (strobe == false) {
-           controller1_status.state = GUI::getControllerStatus();
-           counter = 8;
-       }
-   }
-
-   u8 getController1() {
-       if (counter == 0) {
-           return 1;
-       }
-       u8 val = controller1_status.state & 1;
-       controller1_status.state >>= 1;
-       counter--;
-       return val;
-   }
+void Controller::set_buttons(int port, u8 state) {
+    buttons[port & 1] = state;
+}
 
-   u8 getController2() {
-       return 0;
-   }
+void Controller::setControllerStatus(bool setStrobe) {
+    strobe = setStrobe;
+    if (strobe == false) {
+        controller1_status = buttons[0];
+        controller2_status = buttons[1];
+        counter = 8;
+        counter2 = 8;
+    }
+}
 
+u8 Controller::getController1() {
+    if (counter == 0) {
+        return 1;
+    }
+    u8 val = controller1_status & 1;
+    controller1_status >>= 1;
+    counter--;
+    return val;
 }
 
+u8 Controller::getController2() {
+    if (counter2 == 0) {
+        return 1;
+    }
+    u8 val = controller2_status & 1;
+    controller2_status >>= 1;
+    counter2--;
+    return val;
+}
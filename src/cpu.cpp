@@ -1,1368 +1,1629 @@
-#include <iostream>
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
-#include "include/cpu.hpp"
-#include "include/cartridge.hpp"
-#include "include/ppu.hpp"
-#include "include/controller.hpp"
+#include "include/console.hpp"
+#include "include/trace.hpp"
+#ifdef NES_PROFILE
+#include "include/profiler.hpp"
+#endif
 
-namespace CPU {
+CPU::CPU(Console &console) :
+    ppu(console.ppu), apu(console.apu), cartridge(console.cartridge), controller(console.controller) {
+}
 
-/* CPU state */
-
-    bool debug = false;
-    bool test = false;
-    bool test2 = false;
-
-    int opCode;
-
-    u8 A, X, Y, S; //registers, these are as follows
-    u16 PC;        // A is Accumulator: supports carrying overflow
-    Flags P;       // detection, and so on
-    // X and Y are used for addressing modes(indices)
-    // PC is program counter, S is Stack Pointer
-    // p is status register
-
-    bool irq, nmi; //irq is interrupt request
-    //nmi is non-maskable interrupt
-    u8 ram[0x800];
-
-/* this keeps track of how many CPU cycles are done until next frame */
-    const int TOTAL_CYCLES = 29781;
-    int remainingCycles;
-
-    inline int elapsed() { return TOTAL_CYCLES - remainingCycles; }
-
-    void transferToOamWithDma(u16 addr);
+CPU::~CPU() {
+    delete jit;
+}
 
 /**
  * defining method tick to be t will make easier to include, in  many places
  * tick will be called during each operation
+ *
+ * a tick only schedules the 3 PPU dots, the PPU catches up in bulk when
+ * we sync with it
  */
  #define T tick()
 
-    inline void tick() {
-        remainingCycles--;
-        PPU::doStep();
-        PPU::doStep();
-        PPU::doStep();
-    }
-
-    /**
-     * if r is greater than 255 set Carry flag true
-     * if x + y creates overflow, i.e. x and y are same sign(+/-) and adding
-     * creates opposite sign than they have overflowed
-     */
-    inline void upd_cv(u8 x, u8 y, u16 r) {
-        P[C] = (r > 0xFF);
-        P[V] = ~(x ^ y) & (x ^ r) & 0x80;
-    }
+inline void CPU::tick() {
+    cycles++;
+    ppu.targetClock += 3;
+}
 
-    void set_debug(bool val) {
-        debug = val;
-    }
+/**
+ * if r is greater than 255 set Carry flag true
+ * if x + y creates overflow, i.e. x and y are same sign(+/-) and adding
+ * creates opposite sign than they have overflowed
+ */
+inline void CPU::upd_cv(u8 x, u8 y, u16 r) {
+    P[C] = (r > 0xFF);
+    P[V] = ~(x ^ y) & (x ^ r) & 0x80;
+}
 
-    /**
-     * if x is negative set Negative flag true if x is 0 set Zero Flag true
-     */
-    inline void upd_nz(u8 x) {
-        P[N] = x & 0x80;
-        P[Z] = (x == 0);
-    }
+/**
+ * if x is negative set Negative flag true if x is 0 set Zero Flag true,
+ * only x is kept, the flags are worked out when something reads them
+ */
+inline void CPU::upd_nz(u8 x) {
+    P.set_nz(x);
+}
 
-    /**
-     * if a + i crosses a page(256 mem spots long) return true
-     */
-    inline bool cross(u16 a, u8 i) {
-        return ((a + i) & 0xFF00) != (a & 0xFF00);
-    }
+/**
+ * if a + i crosses a page(256 mem spots long) return true
+ */
+inline bool CPU::cross(u16 a, u8 i) {
+    return ((a + i) & 0xFF00) != (a & 0xFF00);
+}
 
 /*memory access*/
 
-    template<bool wr>
-    u8 inline access(u16 addr, u8 v = 0) {
-        u8 *r;
+template<bool wr>
+u8 inline CPU::access(u16 addr, u8 v) {
+    u8 *r;
 
-        switch (addr) {
+    switch (addr) {
 
-            /*RAM access or one of the 3 mirrors of RAM */
-            case 0x0000 ... 0x1FFF:
-                r = &ram[addr % 0x800];
-                if (wr)
-                    *r = v;
-                return *r;
+        /*RAM access or one of the 3 mirrors of RAM */
+        case 0x0000 ... 0x1FFF:
+            r = &ram[addr % 0x800];
+            if (wr)
+                *r = v;
+            return *r;
 
-            case 0x2000 ... 0x3FFF:
-                return PPU::accessRegisters<wr>(addr, v);
+        case 0x2000 ... 0x3FFF:
+            ppu.sync();
+            return ppu.accessRegisters<wr>(addr, v);
 
-            case 0x4000 ... 0x4013: /*TODO APU and I/O registers*/
-                return 0;
-            case 0x4014:
-                transferToOamWithDma((u16)v << 8);
+        case 0x4000 ... 0x4013:
+        case 0x4015:
+            apu.sync();
+            if (wr) {
+                apu.write(addr, v);
                 return 0;
-            case 0x4016:
-                if (wr) {
-                    Controller::setControllerStatus(v);
-                    return 0x40;
-                }
-                return 0x40 | Controller::getController1();
-            case 0x4017:
+            }
+            return addr == 0x4015 ? apu.read_status() : 0;
+        case 0x4014:
+            transferToOamWithDma((u16)v << 8);
+            return 0;
+        case 0x4016:
+            if (wr) {
+                controller.setControllerStatus(v);
+                return 0x40;
+            }
+            return 0x40 | controller.getController1();
+        case 0x4017:
+            // reads are the second controller, writes the APU frame counter
+            if (wr) {
+                apu.sync();
+                apu.write(addr, v);
                 return 0;
-            case 0x4020 ... 0xFFFF: /*TODO Cartridge space: PRG ROM, PRG RAM, and
+            }
+            return 0x40 | controller.getController2();
+        case 0x4020 ... 0xFFFF: /*TODO Cartridge space: PRG ROM, PRG RAM, and
 			       mapper registers */
-                return Cartridge::access<wr>(addr, v);
-        }
-        return 0;
+            if (wr) {
+                // mapper writes can switch CHR banks or mirroring
+                ppu.sync();
+            } else if (addr >= 0x8000) {
+                return cartridge.prg_read(addr);
+            }
+            return cartridge.access<wr>(addr, v);
     }
+    return 0;
+}
+
+// out of line copies for bench.cpp, the interpreter inlines its own
+template u8 CPU::access<false>(u16, u8);
+template u8 CPU::access<true>(u16, u8);
 
-    /**
-     *  Use direct memory access to transfer to PPU OAM
-     */
-    void transferToOamWithDma(u16 addr) {
+/**
+ *  Use direct memory access to transfer to PPU OAM
+ */
+void CPU::transferToOamWithDma(u16 addr) {
 //        printf("it's happening now \n");
-        for (int i = 0; i < 0x100; i++) {
+    for (int i = 0; i < 0x100; i++) {
+        T;
+        if (i < 0xFE || cycles % 2 == 1) {
             T;
-            if (i < 0xFE || remainingCycles % 2 == 0) {
-                T;
-            }
-            PPU::transferToOamDma(access<false>(addr + i),i);
         }
+        u8 data = access<false>(addr + i);
+        ppu.sync();
+        ppu.transferToOamDma(data, i);
     }
+}
 
 /*ways to access memory*/
 //write to memory
-    inline u8 wr(u16 a, u8 v) {
-        T;
-        return access<true>(a, v);
-    }
+inline u8 CPU::wr(u16 a, u8 v) {
+    T;
+    return access<true>(a, v);
+}
 
 //read from memory
-    inline u8 rd(u16 a) {
-        T;
-        return access<false>(a);
-    }
+inline u8 CPU::rd(u16 a) {
+    T;
+    return access<false>(a);
+}
 
 //read from two addresses a,b,  and merge to 16 bit
-    inline u16 rd16_d(u16 a, u16 b) { return rd(a) | (rd(b) << 8); }
+inline u16 CPU::rd16_d(u16 a, u16 b) { return rd(a) | (rd(b) << 8); }
 
 //read two addys from a
-    inline u16 rd16(u16 a) { return rd16_d(a, a + 1); }
+inline u16 CPU::rd16(u16 a) { return rd16_d(a, a + 1); }
+
+/**
+ * the next byte of the instruction being run, straight from PRG-ROM when
+ * exec found the instruction there, through the bus otherwise
+ */
+inline u8 CPU::fetch() {
+    if (code) {
+        T;
+        PC++;
+        return *code++;
+    }
+    return rd(PC++);
+}
+
+//the byte at a for addressing mode m, an immediate is taken the same way
+template<CPU::Mode m>
+inline u8 CPU::operand(u16 a) {
+    if constexpr (m == &CPU::imm) {
+        if (code) {
+            T;
+            return *code++;
+        }
+    }
+    return rd(a);
+}
 
 //push value onto stack, and adjust stack pointer
-    inline u8 push(u8 v) { return wr(0x100 + (S--), v); }
+inline u8 CPU::push(u8 v) { return wr(0x100 + (S--), v); }
 
 //pop stack
-    inline u8 pop() { return rd(0x100 + (++S)); }
+inline u8 CPU::pop() { return rd(0x100 + (++S)); }
 
 /*Addressing Modes*/
 
 //immediate gets address  after OP code
-    inline u16 imm() { return PC++; }
-
-    inline u16 imm16() {
-        PC += 2;
-        return PC - 2;
-    }
+inline u16 CPU::imm() { return PC++; }
 
 //read from address of 2 bytes after OP code
-    inline u16 abs() { return rd16(imm16()); }
+inline u16 CPU::abs() {
+    u16 lo = fetch();
+    return lo | fetch() << 8;
+}
 
 //read from address of 2 bytes and add to X
-    inline u16 abx() {
-        u16 a = abs();
-        if (cross(a, X))
-            T;
-        return a + X;
-    }
+inline u16 CPU::abx() {
+    u16 a = abs();
+    if (cross(a, X))
+        T;
+    return a + X;
+}
 
 //Special case,  Tick regardless of page cross as is write to memory
-    inline u16 _abx() {
-        T;
-        return abs() + X;
-    }
+inline u16 CPU::_abx() {
+    T;
+    return abs() + X;
+}
 
 //same but for Y these absolute indexed modes
-    inline u16 aby() {
-        u16 a = abs();
-        if (cross(a, Y))
-            T;
-        return a + Y;
-    }
+inline u16 CPU::aby() {
+    u16 a = abs();
+    if (cross(a, Y))
+        T;
+    return a + Y;
+}
 
 //read byte after OP call, zero page indexing
-    inline u16 zp() { return rd(imm()); }
+inline u16 CPU::zp() { return fetch(); }
 
-    inline u16 zpx() {
-        u16 a = zp();
-        return (a + X) % 256;
-    }
+inline u16 CPU::zpx() {
+    u16 a = zp();
+    return (a + X) % 256;
+}
 
-    inline u16 zpy() {
-        u16 a = zp();
-        return (a + Y) % 256;
-    }
+inline u16 CPU::zpy() {
+    u16 a = zp();
+    return (a + Y) % 256;
+}
 
 //indirect addressing
-    inline u16 izx() {
-        u8 i = zpx();
-        return rd16_d(i, (i + 1) % 0x100);
-    }
-
-    inline u16 _izy() {
-        u8 i = zp();
-        return rd16_d(i, (i + 1) % 0x100) + Y;
-    }
-
-    inline u16 izy() {
-        u16 a = _izy();
-        if (cross(a - Y, Y))
-            T;
-        return a;
-    }
+inline u16 CPU::izx() {
+    u8 i = zpx();
+    return rd16_d(i, (i + 1) % 0x100);
+}
+
+inline u16 CPU::_izy() {
+    u8 i = zp();
+    return rd16_d(i, (i + 1) % 0x100) + Y;
+}
+
+inline u16 CPU::izy() {
+    u16 a = _izy();
+    if (cross(a - Y, Y))
+        T;
+    return a;
+}
 
 //Load accumulator OPs
-    template<Mode m>
-    void LDA() {
-        if (test) {
-            printf(" LDA ");
-        }
-        u16 a = m();
-     //   printf("    a is %x    ", a);
-        u8 t = rd(a);
-       // printf("    new val for A is %x   ", t);
-        upd_nz(t);
-        A = t;
-    }
+template<CPU::Mode m>
+void CPU::LDA() {
+    if (test) {
+        printf(" LDA ");
+    }
+    u16 a = (this->*m)();
+ //   printf("    a is %x    ", a);
+    u8 t = operand<m>(a);
+   // printf("    new val for A is %x   ", t);
+    upd_nz(t);
+    A = t;
+}
 
 //Load X register
-    template<Mode m>
-    void LDX() {
-        u16 a = m();
-        //printf(" a is $%02X",a);
-        u8 t = rd(a);
-        //printf(" t is %d   ", t);
-        upd_nz(t);
-        X = t;
-    }
+template<CPU::Mode m>
+void CPU::LDX() {
+    u16 a = (this->*m)();
+    //printf(" a is $%02X",a);
+    u8 t = operand<m>(a);
+    //printf(" t is %d   ", t);
+    upd_nz(t);
+    X = t;
+}
 
 //Load Y register
-    template<Mode m>
-    void LDY() {
-        if (test) {
-            printf(" LDY ");
-        }
-        u16 a = m();
-        u8 t = rd(a);
-        upd_nz(t);
-        Y = t;
+template<CPU::Mode m>
+void CPU::LDY() {
+    if (test) {
+        printf(" LDY ");
     }
+    u16 a = (this->*m)();
+    u8 t = operand<m>(a);
+    upd_nz(t);
+    Y = t;
+}
 
 /*STx ops */
-    template<u8 &r, Mode m>
-    void st() {
-        u16 addr = m();
-        if (test) {
-            printf(" STx %X ", addr);
-        }
-        wr(addr, r); }
-
-    template<>
-    void st<A, abx>() {
-        T;
-        wr(abs() + X, A);
-    }
-
-    template<>
-    void st<A, aby>() {
-        T;
-        wr(abs() + Y, A);
-    }
-
-    template<>
-    void st<A, izy>() {
-        T;
-        wr(_izy(), A);
-    }
+template<u8 CPUState::*r, CPU::Mode m>
+void CPU::st() {
+    u16 addr = (this->*m)();
+    if (test) {
+        printf(" STx %X ", addr);
+    }
+    wr(addr, this->*r); }
+
+template<>
+void CPU::st<&CPU::A, &CPU::abx>() {
+    T;
+    wr(abs() + X, A);
+}
+
+template<>
+void CPU::st<&CPU::A, &CPU::aby>() {
+    T;
+    wr(abs() + Y, A);
+}
+
+template<>
+void CPU::st<&CPU::A, &CPU::izy>() {
+    T;
+    wr(_izy(), A);
+}
 
 /*Transfer OPS*/
-    template<u8 &d, u8 &s>
-    void tr() {
-        upd_nz(s = d);
-        T;
-    }
-
-    template<>
-    void tr<X, S>() {
-        S = X;
-        T;
-    }
+template<u8 CPUState::*d, u8 CPUState::*s>
+void CPU::tr() {
+    upd_nz(this->*s = this->*d);
+    T;
+}
+
+template<>
+void CPU::tr<&CPU::X, &CPU::S>() {
+    S = X;
+    T;
+}
 //no need to update flags for TXS ^^
 
 /*get value at address using address mode */
 #define G      \
-  u16 a = m(); \
-  u8 p = rd(a);
+  u16 a = (this->*m)(); \
+  u8 p = operand<m>(a);
 
 /*ADC*/
-    template<Mode m>
-    void ADC() {
-        G;
-        if (test) {
-            printf(" ADC ");
-        }
-        u16 r = A + p + P[C];
-        upd_cv(A, p, r);
-        upd_nz(A = r);
-    }
+template<CPU::Mode m>
+void CPU::ADC() {
+    G;
+    if (test) {
+        printf(" ADC ");
+    }
+    u16 r = A + p + P[C];
+    upd_cv(A, p, r);
+    upd_nz(A = r);
+}
 /*SBC*/
 //Subtract from accumulator
-    template<Mode m>
-    void SBC() {
-        G;
-        if (test) {
-            printf(" SBC ");
-        }
-        p = ~p; //take complement of value taken from memory
-        u16 r = A + p + P[C];
-        upd_cv(A, p, r);
-        upd_nz(A = r);
-    }
+template<CPU::Mode m>
+void CPU::SBC() {
+    G;
+    if (test) {
+        printf(" SBC ");
+    }
+    p = ~p; //take complement of value taken from memory
+    u16 r = A + p + P[C];
+    upd_cv(A, p, r);
+    upd_nz(A = r);
+}
 
 /*DEC from memory-- */
-    template<Mode m>
-    void DEC() {
-        G;
-        T;
-        if (test) {
-            printf(" DEC ");
-        }
-        wr(a, --p);
-        upd_nz(p);
+template<CPU::Mode m>
+void CPU::DEC() {
+    G;
+    T;
+    if (test) {
+        printf(" DEC ");
     }
+    wr(a, --p);
+    upd_nz(p);
+}
 
 /* decrement from registers */
-    void DEX() {
-        T;
-        if (test) {
-            printf(" DEX ");
-        }
-        upd_nz(--X);
+void CPU::DEX() {
+    T;
+    if (test) {
+        printf(" DEX ");
     }
+    upd_nz(--X);
+}
 
-    void DEY() {
-        T;
-        if (test) {
-            printf(" DEY ");
-        }
-        upd_nz(--Y);
+void CPU::DEY() {
+    T;
+    if (test) {
+        printf(" DEY ");
     }
+    upd_nz(--Y);
+}
 
 /*INC from memory*/
-    template<Mode m>
-    void INC() {
-        G;
-        T;
-        if (test) {
-            printf(" INC ");
-        }
-        wr(a, ++p);
-        upd_nz(p);
+template<CPU::Mode m>
+void CPU::INC() {
+    G;
+    T;
+    if (test) {
+        printf(" INC ");
     }
+    wr(a, ++p);
+    upd_nz(p);
+}
 
 /*increment registers*/
-    void INX() {
-        T;
-        if (test) {
-            printf(" INX ");
-        }
-        upd_nz(++X);
+void CPU::INX() {
+    T;
+    if (test) {
+        printf(" INX ");
     }
+    upd_nz(++X);
+}
 
-    void INY() {
-        T;
-        if (test) {
-            printf(" INY ");
-        }
-        upd_nz(++Y);
+void CPU::INY() {
+    T;
+    if (test) {
+        printf(" INY ");
     }
+    upd_nz(++Y);
+}
 
 /*BITWISE OPS*/
 
-    template<Mode m>
-    void AND() {
-        G;
-        if (test) {
-            printf(" AND ");
-        }
-        u8 v = A & p;
-        upd_nz(A = v);
+template<CPU::Mode m>
+void CPU::AND() {
+    G;
+    if (test) {
+        printf(" AND ");
     }
+    u8 v = A & p;
+    upd_nz(A = v);
+}
 
 //Shift left 1 bit, accumulater
-    void ASL() {
-        if (test) {
-            printf(" ASL ");
-        }
-        u16 r = A << 1;
-        P[C] = r > 0xFF;
-        upd_nz(A = r);
-        T;
+void CPU::ASL() {
+    if (test) {
+        printf(" ASL ");
     }
+    u16 r = A << 1;
+    P[C] = r > 0xFF;
+    upd_nz(A = r);
+    T;
+}
 
 //shift memory location left
-    template<Mode m>
-    void ASL() {
-        G;
-        if (test) {
-            printf(" ASL ");
-        }
-        P[C] = p & 0x80; //shift leftmost bit into carry flag;
-        T;
-        upd_nz(wr(a, p << 1));
+template<CPU::Mode m>
+void CPU::ASL() {
+    G;
+    if (test) {
+        printf(" ASL ");
     }
+    P[C] = p & 0x80; //shift leftmost bit into carry flag;
+    T;
+    upd_nz(wr(a, p << 1));
+}
 
 /*BIT testing, bits 6 and 7 go status register(N and V) */
-    template<Mode m>
-    void BIT() {
-        G;
-        if (test) {
-            printf(" BIT ");
-        }
-        P[Z] = !(A & p);
-        P[N] = p & 0x80; //bit 7 to N
-        P[V] = p & 0x40; //bit 6 to V
+template<CPU::Mode m>
+void CPU::BIT() {
+    G;
+    if (test) {
+        printf(" BIT ");
     }
+    P.set_nz(p & 0x80, !(A & p)); //bit 7 to N
+    P[V] = p & 0x40; //bit 6 to V
+}
 
 //exclusive OR
-    template<Mode m>
-    void EOR() {
-        G;
-        if (test) {
-            printf(" EOR ");
-        }
-        upd_nz(A = (p ^ A));
+template<CPU::Mode m>
+void CPU::EOR() {
+    G;
+    if (test) {
+        printf(" EOR ");
     }
+    upd_nz(A = (p ^ A));
+}
 
 //Shift one bit right move, move 0th bit to Carry
-    void LSR() {
-        if (test) {
-            printf(" LSR ");
-        }
-        P[C] = A & 0x01;
-        upd_nz(A >>= 1);
-        T;
-    }
-
-    //Shift left one bit, then or with memory
-    template<Mode m>
-    void SLO() {
-        G;
-        if (test) {
-            printf(" SLO ");
-        }
-        P[C] = p & 0x80;
-        upd_nz(wr(a, p << 1));
-    }
-
-    template<Mode m>
-    void LSR() {
-        G;
-        if (test) {
-            printf(" LSR ");
-        }
-        P[C] = p & 0x01;
-        upd_nz(wr(a, p >> 1));
-        T;
-    }
+void CPU::LSR() {
+    if (test) {
+        printf(" LSR ");
+    }
+    P[C] = A & 0x01;
+    upd_nz(A >>= 1);
+    T;
+}
+
+//Shift left one bit, then or with memory
+template<CPU::Mode m>
+void CPU::SLO() {
+    G;
+    if (test) {
+        printf(" SLO ");
+    }
+    P[C] = p & 0x80;
+    upd_nz(wr(a, p << 1));
+}
+
+template<CPU::Mode m>
+void CPU::LSR() {
+    G;
+    if (test) {
+        printf(" LSR ");
+    }
+    P[C] = p & 0x01;
+    upd_nz(wr(a, p >> 1));
+    T;
+}
 
 //Or value from memory with Accumulator, insert result into A
-    template<Mode m>
-    void ORA() {
-        G;
-        if (test) {
-            printf(" ORA ");
-        }
-        upd_nz(A |= p);
+template<CPU::Mode m>
+void CPU::ORA() {
+    G;
+    if (test) {
+        printf(" ORA ");
     }
+    upd_nz(A |= p);
+}
 
 //Rotate value one bit to left, update carry with MSB, update N,Z
-    template<Mode m>
-    void ROL() {
-        G;
-        T;
-        if (test) {
-            printf(" ROL ");
-        }
-        u8 carry = A & 0x80;
-        p = (p << 1) + P[C];
-        P[C] = carry;
-        upd_nz(wr(a, p));
-    }
-
-    void ROL() {
-        if (test) {
-            printf(" ROL ");
-        }
-        u8 carry = A & 0x80;
-        A = (A << 1) + P[C];
-        P[C] = carry;
-        upd_nz(A);
-        T;
-    }
+template<CPU::Mode m>
+void CPU::ROL() {
+    G;
+    T;
+    if (test) {
+        printf(" ROL ");
+    }
+    u8 carry = A & 0x80;
+    p = (p << 1) + P[C];
+    P[C] = carry;
+    upd_nz(wr(a, p));
+}
+
+void CPU::ROL() {
+    if (test) {
+        printf(" ROL ");
+    }
+    u8 carry = A & 0x80;
+    A = (A << 1) + P[C];
+    P[C] = carry;
+    upd_nz(A);
+    T;
+}
 
 //Rotate one bit right, update carry with LSB, update N,Z
-    template<Mode m>
-    void ROR() {
-        G;
-        if (test) {
-            printf(" ROR ");
-        }
-        u8 carry = P[C];
-        P[C] = p & 0x01;
-        p = (p >> 1) + (carry << 7);
-        upd_nz(wr(a, p));
-        T;
-    }
+template<CPU::Mode m>
+void CPU::ROR() {
+    G;
+    if (test) {
+        printf(" ROR ");
+    }
+    u8 carry = P[C];
+    P[C] = p & 0x01;
+    p = (p >> 1) + (carry << 7);
+    upd_nz(wr(a, p));
+    T;
+}
+
+void CPU::ROR() {
+    if (test) {
+        printf(" ROR ");
+    }
+    u8 carry = A & 0x1;
+    A = (A >> 1) + (P[C] << 7);
+    P[C] = carry;
+    upd_nz(A);
+    T;
+}
 
-    void ROR() {
-        if (test) {
-            printf(" ROR ");
-        }
-        u8 carry = A & 0x1;
-        A = (A >> 1) + (P[C] << 7);
-        P[C] = carry;
-        upd_nz(A);
+/**
+ * the branch instructions: one cycle more when taken, one more again when
+ * that lands on another page.  Taken backwards it may be an idle loop
+ */
+inline void CPU::branch(bool taken) {
+    u16 at = PC - 1;
+    s8 p = fetch();
+    if (taken) {
         T;
+        if (cross(PC, p))
+            T;
+        PC += p;
+        if (p < 0) {
+            idle_loop(at);
+        }
     }
+}
 
 //Branch on carry clear, P[C] = 0, PC will move to next location
-    void BCC() {
-        if (test) {
-            printf(" BCC ");
-        }
-        s8 p = rd(imm());
-        if (!P[C]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BCC() {
+    if (test) {
+        printf(" BCC ");
     }
+    branch(!P[C]);
+}
 
 //Branch on carry set, if P[C], program counter will move to next location
-    void BCS() {
-        if (test) {
-            printf(" BCS ");
-        }
-        s8 p = rd(imm());
-        if (P[C]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BCS() {
+    if (test) {
+        printf(" BCS ");
     }
+    branch(P[C]);
+}
 
 //branch on result zero
-    void BEQ() {
-        if (test) {
-            printf(" BEQ ");
-        }
-        s8 p = rd(imm());
-        if (P[Z]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BEQ() {
+    if (test) {
+        printf(" BEQ ");
     }
+    branch(P.zero());
+}
 
 //branch on result minus
-    void BMI() {
-        if (test) {
-            printf(" BMI ");
-        }
-        s8 p = rd(imm());
-        if (P[N]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BMI() {
+    if (test) {
+        printf(" BMI ");
     }
+    branch(P.negative());
+}
 
 //branch on not zero
-    void BNE() {
-        if (test) {
-            printf(" BNE ");
-        }
-        s8 p = rd(imm());
-        if (!P[Z]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BNE() {
+    if (test) {
+        printf(" BNE ");
     }
+    branch(!P.zero());
+}
 
 //branch on result plus
-    void BPL() {
-        if (test) {
-            printf(" BPL ");
-        }
-        s8 p = rd(imm());
-        if (!P[N]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BPL() {
+    if (test) {
+        printf(" BPL ");
     }
+    branch(!P.negative());
+}
 
 //Branch on overflow flag clear
-    void BVC() {
-        if (test) {
-            printf(" BVC ");
-        }
-        s8 p = rd(imm());
-        if (!P[V]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BVC() {
+    if (test) {
+        printf(" BVC ");
     }
+    branch(!P[V]);
+}
 
 //Branch on carry flag set
-    void BVS() {
-        if (test) {
-            printf(" BVS ");
-        }
-        s8 p = rd(imm());
-        if (P[V]) {
-            T;
-            if (cross(PC, p))
-                T;
-            PC += p;
-        }
+void CPU::BVS() {
+    if (test) {
+        printf(" BVS ");
     }
+    branch(P[V]);
+}
 /*Stack Operations*/
 //Push A onto stack
-    void PHA() {
-        T;
-        push(A);
-    }
+void CPU::PHA() {
+    T;
+    push(A);
+}
 
 //Pull A from stack
-    void PLA() {
-        if (test) {
-            printf(" PLA ");
-        }
-        T;
-        T;
-        A = pop();
-        upd_nz(A);
+void CPU::PLA() {
+    if (test) {
+        printf(" PLA ");
     }
+    T;
+    T;
+    A = pop();
+    upd_nz(A);
+}
 
 //Push Processor Statuses onto stack
-    void PHP() {
-        T;
-        push(P.get() | (1 << 4));
-    } //set B flag
+void CPU::PHP() {
+    T;
+    push(P.get() | (1 << 4));
+} //set B flag
 //Pull Processor Status from stack
-    void PLP() {
-        T;
-        T;
-        u8 temp = pop();
-        //std::cout << " putting into P = " << (int) temp << std::endl;
-        P.set(temp);
-    }
+void CPU::PLP() {
+    T;
+    T;
+    u8 temp = pop();
+    //std::cout << " putting into P = " << (int) temp << std::endl;
+    P.set(temp);
+}
 //
 
 //Jump to address made from next 2 bytes
-    void JMP() {
-        if (test) {
-            printf(" JMP ");
-        }
-        PC = abs();
+void CPU::JMP() {
+    if (test) {
+        printf(" JMP ");
     }
+    u16 at = PC - 1;
+    PC = abs();
+    if (PC <= at) {
+        idle_loop(at);
+    }
+}
 /*Indirect JMP */
 //Jump to address, by reading from memory at address of next 2 bytes
-    void i_JMP() {
-        u16 a = abs();
-        if (cross(a, 1))
-            PC = rd16_d(a, a - 0xFF);
-        else
-            PC = rd16(a);
-    }
+void CPU::i_JMP() {
+    u16 a = abs();
+    if (cross(a, 1))
+        PC = rd16_d(a, a - 0xFF);
+    else
+        PC = rd16(a);
+}
 
 //Jump to subroutine
-    void JSR() {
-        if (test) {
-            printf(" JSR ");
-        }
-        u16 t = PC + 1;
-        T;
-        push(t >> 8);
-        push(t);
-        PC = rd16(imm16());
+void CPU::JSR() {
+    if (test) {
+        printf(" JSR ");
     }
+    u16 t = PC + 1;
+    T;
+    push(t >> 8);
+    push(t);
+    PC = abs();
+}
 
 //Return from interrupt
-    void RTI() {
-        T;
-        T;
-        P.set(pop());
-        PC = pop();
-        PC = pop() << 8 | PC;
-    }
+void CPU::RTI() {
+    T;
+    T;
+    P.set(pop());
+    PC = pop();
+    PC = pop() << 8 | PC;
+}
 
 //Return from subroutine
-    void RTS() {
-        if (test) {
-            printf(" RTS ");
-        }
-        T;
-        T;
-        PC = pop() | pop() << 8;
-        PC++;
-
-        //std::cout << "jumpoint to sub from " << std::hex << (int) PC << std::endl;
-        T;
+void CPU::RTS() {
+    if (test) {
+        printf(" RTS ");
     }
+    T;
+    T;
+    PC = pop() | pop() << 8;
+    PC++;
+
+    //std::cout << "jumpoint to sub from " << std::hex << (int) PC << std::endl;
+    T;
+}
 
 //BReaK
-    void BRK() {
-        T;
-        u16 t = PC + 2;
-        push(t >> 8);
-        push(t);
-        PC = rd(0xFFFE);
-        PC = (rd(0xFFFF) << 8) | PC;
-        push(P.get() | (1 << 4));
-    }
+void CPU::BRK() {
+    T;
+    u16 t = PC + 2;
+    push(t >> 8);
+    push(t);
+    PC = rd(0xFFFE);
+    PC = (rd(0xFFFF) << 8) | PC;
+    push(P.get() | (1 << 4));
+}
 
 /*Status Register Change*/
 //Clear flag
-    template<Flag f>
-    void cl() {
-        if (test) {
-            printf(" CL ");
-        }
-        P[f] = 0;
-        T;
+template<CPU::Flag f>
+void CPU::cl() {
+    static_assert(f < Z, "Z and N are cleared through set_nz");
+    if (test) {
+        printf(" CL ");
     }
+    P[f] = 0;
+    T;
+}
 
 //Set flag
-    template<Flag f>
-    void set() {
-        P[f] = 1;
-        T;
-    }
+template<CPU::Flag f>
+void CPU::set() {
+    static_assert(f < Z, "Z and N are set through set_nz");
+    P[f] = 1;
+    T;
+}
 
 /*Compare Ops  CMx*/
 //Register - Memory
 // Memory > Register : set N
 // Memory = Register : set Z and C
 // Memory < Register : set C
-    template<u8 &r, Mode m>
-    void cmp() {
-        G;
-        upd_nz(r - p);
-        P[C] = (r >= p);
-    }
+template<u8 CPUState::*r, CPU::Mode m>
+void CPU::cmp() {
+    G;
+    upd_nz(this->*r - p);
+    P[C] = (this->*r >= p);
+}
+
+// Double No op
+template<CPU::Mode m>
+void CPU::DOP() {
+    (this->*m)();
+    T;
+    T;
+}
+
+// Triple No op
+void CPU::TOP() {
+    T;T;T;
+}
+
+// increase memory by one
+template<CPU::Mode m>
+void CPU::ISC() {
+    G;
+    T;
+    wr(a, ++p);
+    p = ~p; //then SBC it
+    u16 r = A + p + P[C];
+    upd_cv(A, p, r);
+    upd_nz(A = r);
+}
+
+// Shift right one bit then EOR accumulator with memory
+template<CPU::Mode m>
+void CPU::SRE() {
+
+}
+
+// decrement memory, then compare it with the accumulator
+template<CPU::Mode m>
+void CPU::DCP() {
+    G;
+    T;
+    wr(a, --p);
+    upd_nz(A - p);
+    P[C] = (A >= p);
+}
+
+void CPU::NOP() { T; }
+
+template<CPU::Mode m>
+void CPU::NOP() {
+    u8 addr = (this->*m)();
+    rd(addr);
+    T;
+}
+
+// Unofficial, skip over the zero page operand
+void CPU::SKB() {
+    PC++;
+    NOP();
+}
 
-    // Double No op
-    template<Mode m>
-    void DOP() {
-        m();
-        T;
-        T;
-    }
+/**
+ * Unofficial KIL: the CPU stops fetching, only a reset gets it going
+ * again.  Left on the opcode so PC says where it happened
+ */
+void CPU::jam() {
+    PC--;
+    jammed = true;
+    T;
+}
+
+//stderr, so stdout stays the tools' results
+void CPU::undefined() {
+    NOP();
+    fprintf(stderr, "undefined opcode %02X at $%04X\n", opCode, (u16) (PC - 1));
+}
 
-    // Triple No op
-    void TOP() {
-        T;T;T;
-    }
+/**
+ * Every opcode resolved to its instantiated handler up front, so exec
+ * dispatches with one indexed indirect call instead of walking a switch
+ */
+struct CPU::OpTable {
+    Op op[256];
+    Op fused[256];  // with the idioms below, for the untraced interpreter
+
+    OpTable() {
+        for (Op &o : op) {
+            o = &CPU::undefined;
+        }
 
-    // increase memory by one
-    template <Mode m>
-    void ISC() {
-        G;
-        p++;
-        upd_cv(A, -p, a);
-        wr(a, p);
-        A -= p + P[C];
+        op[0x03] = &CPU::SLO<&CPU::izx>;
+        op[0x14] = &CPU::DOP<&CPU::zpx>;
+        op[0x1A] = &CPU::NOP;
+        op[0x1C] = &CPU::TOP;
+        /*Storage OPs */
+        //LDA
+        op[0xA9] = &CPU::LDA<&CPU::imm>;
+        op[0xA5] = &CPU::LDA<&CPU::zp>;
+        op[0xB5] = &CPU::LDA<&CPU::zpx>;
+        op[0xAD] = &CPU::LDA<&CPU::abs>;
+        op[0xBD] = &CPU::LDA<&CPU::abx>;
+        op[0xB9] = &CPU::LDA<&CPU::aby>;
+        op[0xA1] = &CPU::LDA<&CPU::izx>;
+        op[0xB1] = &CPU::LDA<&CPU::izy>;
+        //LDX
+        op[0xA2] = &CPU::LDX<&CPU::imm>;
+        op[0xA6] = &CPU::LDX<&CPU::zp>;
+        op[0xB6] = &CPU::LDX<&CPU::zpy>;
+        op[0xAE] = &CPU::LDX<&CPU::abs>;
+        op[0xBE] = &CPU::LDX<&CPU::aby>;
+        //LDY
+        op[0xA0] = &CPU::LDY<&CPU::imm>;
+        op[0xA4] = &CPU::LDY<&CPU::zp>;
+        op[0xB4] = &CPU::LDY<&CPU::zpx>;
+        op[0xAC] = &CPU::LDY<&CPU::abs>;
+        op[0xBC] = &CPU::LDY<&CPU::abx>;
+
+        //STA
+        op[0x85] = &CPU::st<&CPU::A, &CPU::zp>;
+        op[0x95] = &CPU::st<&CPU::A, &CPU::zpx>;
+        op[0x8D] = &CPU::st<&CPU::A, &CPU::abs>;
+        op[0x9D] = &CPU::st<&CPU::A, &CPU::abx>;
+        op[0x99] = &CPU::st<&CPU::A, &CPU::aby>;
+        op[0x81] = &CPU::st<&CPU::A, &CPU::izx>;
+        op[0x91] = &CPU::st<&CPU::A, &CPU::izy>;
+
+        //STX
+        op[0x86] = &CPU::st<&CPU::X, &CPU::zp>;
+        op[0x96] = &CPU::st<&CPU::X, &CPU::zpy>;
+        op[0x8E] = &CPU::st<&CPU::X, &CPU::abs>;
+
+        //STY
+        op[0x84] = &CPU::st<&CPU::Y, &CPU::zp>;
+        op[0x94] = &CPU::st<&CPU::Y, &CPU::zpx>;
+        op[0x8C] = &CPU::st<&CPU::Y, &CPU::abs>;
+
+        //TAY
+        op[0xA8] = &CPU::tr<&CPU::A, &CPU::Y>;
+
+        //TAX
+        op[0xAA] = &CPU::tr<&CPU::A, &CPU::X>;
+
+        //TSX
+        op[0xBA] = &CPU::tr<&CPU::S, &CPU::X>;
+
+        //TXA
+        op[0x8A] = &CPU::tr<&CPU::X, &CPU::A>;
+
+        //TXS
+        op[0x9A] = &CPU::tr<&CPU::X, &CPU::S>;
+
+        //TYA
+        op[0x98] = &CPU::tr<&CPU::Y, &CPU::A>;
+
+        //ADC
+        op[0x69] = &CPU::ADC<&CPU::imm>;
+        op[0x65] = &CPU::ADC<&CPU::zp>;
+        op[0x75] = &CPU::ADC<&CPU::zpx>;
+        op[0x6D] = &CPU::ADC<&CPU::abs>;
+        op[0x7D] = &CPU::ADC<&CPU::abx>;
+        op[0x79] = &CPU::ADC<&CPU::aby>;
+        op[0x61] = &CPU::ADC<&CPU::izx>;
+        op[0x71] = &CPU::ADC<&CPU::izy>;
+
+        //SBC
+        op[0xE9] = &CPU::SBC<&CPU::imm>;
+        op[0xE5] = &CPU::SBC<&CPU::zp>;
+        op[0xF5] = &CPU::SBC<&CPU::zpx>;
+        op[0xED] = &CPU::SBC<&CPU::abs>;
+        op[0xFD] = &CPU::SBC<&CPU::abx>;
+        op[0xF9] = &CPU::SBC<&CPU::aby>;
+        op[0xE1] = &CPU::SBC<&CPU::izx>;
+        op[0xF1] = &CPU::SBC<&CPU::izy>;
+
+        //DEC
+        op[0xC6] = &CPU::DEC<&CPU::zp>;
+        op[0xD6] = &CPU::DEC<&CPU::zpx>;
+        op[0xCE] = &CPU::DEC<&CPU::abs>;
+        op[0xDE] = &CPU::DEC<&CPU::_abx>; // use _abx because we always Tick to check
+        // if writing to right mem location page
+        // cross
+
+        //DEX
+        op[0xCA] = &CPU::DEX;
+
+        //DEY
+        op[0x88] = &CPU::DEY;
+
+        //INC
+        op[0xE6] = &CPU::INC<&CPU::zp>;
+        op[0xF6] = &CPU::INC<&CPU::zpx>;
+        op[0xEE] = &CPU::INC<&CPU::abs>;
+        op[0xFE] = &CPU::INC<&CPU::_abx>; //Tick regardless of page cross
+
+        //INX
+        op[0xE8] = &CPU::INX;
+
+        //INY
+        op[0xC8] = &CPU::INY;
+
+        //AND
+        op[0x29] = &CPU::AND<&CPU::imm>;
+        op[0x25] = &CPU::AND<&CPU::zp>;
+        op[0x35] = &CPU::AND<&CPU::zpx>;
+        op[0x2D] = &CPU::AND<&CPU::abs>;
+        op[0x3D] = &CPU::AND<&CPU::abx>;
+        op[0x39] = &CPU::AND<&CPU::aby>;
+        op[0x21] = &CPU::AND<&CPU::izx>;
+        op[0x31] = &CPU::AND<&CPU::_izy>; //
+
+        //ASL
+        op[0x0A] = &CPU::ASL;
+        op[0x06] = &CPU::ASL<&CPU::zp>;
+        op[0x16] = &CPU::ASL<&CPU::zpx>;
+        op[0x0E] = &CPU::ASL<&CPU::abs>;
+        op[0x1E] = &CPU::ASL<&CPU::_abx>; //Always tick when writing to mem (x page)
+
+        //BIT
+        op[0x24] = &CPU::BIT<&CPU::zp>;
+        op[0x2C] = &CPU::BIT<&CPU::abs>;
+
+        //EOR
+        op[0x49] = &CPU::EOR<&CPU::imm>;
+        op[0x45] = &CPU::EOR<&CPU::zp>;
+        op[0x55] = &CPU::EOR<&CPU::zpx>;
+        op[0x4D] = &CPU::EOR<&CPU::abs>;
+        op[0x5D] = &CPU::EOR<&CPU::abx>;
+        op[0x59] = &CPU::EOR<&CPU::aby>;
+        op[0x41] = &CPU::EOR<&CPU::izx>;
+        op[0x51] = &CPU::EOR<&CPU::izy>;
+
+        //LSR
+        op[0x4A] = &CPU::LSR;
+        op[0x46] = &CPU::LSR<&CPU::zp>;
+        op[0x56] = &CPU::LSR<&CPU::zpx>;
+        op[0x4E] = &CPU::LSR<&CPU::abs>;
+        op[0x5E] = &CPU::LSR<&CPU::_abx>;
+
+        //ORA
+        op[0x09] = &CPU::ORA<&CPU::imm>;
+        op[0x05] = &CPU::ORA<&CPU::zp>;
+        op[0x15] = &CPU::ORA<&CPU::zpx>;
+        op[0x0D] = &CPU::ORA<&CPU::abs>;
+        op[0x1D] = &CPU::ORA<&CPU::abx>;
+        op[0x19] = &CPU::ORA<&CPU::aby>;
+        op[0x01] = &CPU::ORA<&CPU::izx>;
+        op[0x11] = &CPU::ORA<&CPU::_izy>;
+
+        //ROL
+        op[0x2A] = &CPU::ROL;
+        op[0x26] = &CPU::ROL<&CPU::zp>;
+        op[0x36] = &CPU::ROL<&CPU::zpx>;
+        op[0x2E] = &CPU::ROL<&CPU::abs>;
+        op[0x3E] = &CPU::ROL<&CPU::_abx>;
+
+        //ROR
+        op[0x6A] = &CPU::ROR;
+        op[0x66] = &CPU::ROR<&CPU::zp>;
+        op[0x76] = &CPU::ROR<&CPU::zpx>;
+        op[0x6E] = &CPU::ROR<&CPU::abs>;
+        op[0x7E] = &CPU::ROR<&CPU::_abx>;
+
+        /*Stack Operations */
+        op[0x48] = &CPU::PHA;
+        op[0x08] = &CPU::PHP;
+        op[0x68] = &CPU::PLA;
+        op[0x28] = &CPU::PLP;
+
+        //BRANCH
+        op[0x90] = &CPU::BCC;
+        op[0xB0] = &CPU::BCS;
+        op[0xF0] = &CPU::BEQ;
+        op[0x30] = &CPU::BMI;
+        op[0xD0] = &CPU::BNE;
+        op[0x10] = &CPU::BPL;
+        op[0x50] = &CPU::BVC;
+        op[0x70] = &CPU::BVS;
+
+        //JMP
+        op[0x4C] = &CPU::JMP;
+        op[0x6C] = &CPU::i_JMP;
+        op[0x20] = &CPU::JSR;
+        op[0x40] = &CPU::RTI;
+        op[0x60] = &CPU::RTS;
+        op[0x00] = &CPU::BRK;
+
+        //Flag Setting and Clearing
+        op[0x18] = &CPU::cl<C>; //clear
+        op[0xD8] = &CPU::cl<D>;
+        op[0x58] = &CPU::cl<I>;
+        op[0xB8] = &CPU::cl<V>;
+        op[0x38] = &CPU::set<C>; //set
+        op[0xF8] = &CPU::set<D>;
+        op[0x78] = &CPU::set<I>;
+
+        //Compare OPS
+        //Compare against A (CMP)
+        op[0xC9] = &CPU::cmp<&CPU::A, &CPU::imm>;
+        op[0xC5] = &CPU::cmp<&CPU::A, &CPU::zp>;
+        op[0xD5] = &CPU::cmp<&CPU::A, &CPU::zpx>;
+        op[0xCD] = &CPU::cmp<&CPU::A, &CPU::abs>;
+        op[0xDD] = &CPU::cmp<&CPU::A, &CPU::abx>;
+        op[0xD9] = &CPU::cmp<&CPU::A, &CPU::aby>;
+        op[0xC1] = &CPU::cmp<&CPU::A, &CPU::izx>;
+        op[0xD1] = &CPU::cmp<&CPU::A, &CPU::izy>;
+
+        //Compare X (CPX)
+        op[0xE0] = &CPU::cmp<&CPU::X, &CPU::imm>;
+        op[0xE4] = &CPU::cmp<&CPU::X, &CPU::zp>;
+        op[0xEC] = &CPU::cmp<&CPU::X, &CPU::abs>;
+
+        //Compare Y (CPY)
+        op[0xC0] = &CPU::cmp<&CPU::Y, &CPU::imm>;
+        op[0xC4] = &CPU::cmp<&CPU::Y, &CPU::zp>;
+        op[0xCC] = &CPU::cmp<&CPU::Y, &CPU::abs>;
+
+        //NOP
+        op[0xEA] = &CPU::NOP;
+        op[0x44] = &CPU::NOP<&CPU::zp>;
+        op[0x64] = &CPU::NOP<&CPU::zp>;
+        op[0x0C] = &CPU::NOP<&CPU::abs>;
+        op[0x34] = &CPU::NOP<&CPU::zpx>;
+        op[0x54] = &CPU::NOP<&CPU::zpx>;
+        op[0x74] = &CPU::NOP<&CPU::zpx>;
+        op[0xD4] = &CPU::NOP<&CPU::zpx>;
+        op[0xF4] = &CPU::NOP<&CPU::zpx>;
+        op[0x3A] = &CPU::NOP;
+        op[0x5A] = &CPU::NOP;
+        op[0x7A] = &CPU::NOP;
+        op[0xDA] = &CPU::NOP;
+        op[0xFA] = &CPU::NOP;
+        op[0x80] = &CPU::NOP<&CPU::imm>;
+        op[0x89] = &CPU::NOP<&CPU::imm>;
+
+        //Unofficial
+        op[0x04] = &CPU::SKB;
+        op[0xFF] = &CPU::ISC<&CPU::_abx>;
+        op[0xCF] = &CPU::DCP<&CPU::abs>;
+        op[0xD3] = &CPU::DCP<&CPU::izy>;
+        op[0xD7] = &CPU::DCP<&CPU::zpx>;
+        op[0xDB] = &CPU::DCP<&CPU::aby>;
+        op[0xDF] = &CPU::DCP<&CPU::_abx>;
+        op[0xC7] = &CPU::DCP<&CPU::zp>;
+
+        op[0xD2] = &CPU::jam;
+
+        // the same, except for the opcodes that start an idiom
+        for (int i = 0; i < 256; i++) {
+            fused[i] = op[i];
+        }
+        fused[0xCA] = &CPU::fuse<DEX_BNE, &CPU::DEX, &CPU::BNE>;
+        fused[0x88] = &CPU::fuse<DEY_BNE, &CPU::DEY, &CPU::BNE>;
+        fused[0xA5] = &CPU::fuse<LDA_CMP_BNE, &CPU::LDA<&CPU::zp>, &CPU::cmp<&CPU::A, &CPU::imm>, &CPU::BNE>;
+        fused[0xE6] = &CPU::fuse<INC_LDA, &CPU::INC<&CPU::zp>, &CPU::LDA<&CPU::zp>>;
+        fused[0x2C] = &CPU::fuse<BIT_BPL, &CPU::BIT<&CPU::abs>, &CPU::BPL>;
     }
+};
 
-    // Shift right one bit then EOR accumulator with memory
-    template <Mode m>
-    void SRE() {
+const CPU::OpTable CPU::opTable;
 
+/*
+ * Fused idioms.  Counting loops and polling a flag take a large share of
+ * most games' instructions, a few instructions at a time.  Where one of
+ * these sequences sits in PRG-ROM its first opcode's handler runs the
+ * whole of it, saving the trips round the run loop in between.
+ */
+struct CPU::Idiom {
+    const char *name;
+    int count;      // instructions
+    u8 ops[3];      // their opcodes
+    u8 at[3];       // and where each one is from the start
+    int length;     // bytes
+    int maxCycles;  // the most it can take, with its branch taken onto another page
+};
+
+const CPU::Idiom CPU::idioms[IDIOMS] = {
+    {"DEX BNE", 2, {0xCA, 0xD0}, {0, 1}, 3, 6},
+    {"DEY BNE", 2, {0x88, 0xD0}, {0, 1}, 3, 6},
+    {"LDA zp CMP # BNE", 3, {0xA5, 0xC9, 0xD0}, {0, 2, 4}, 6, 9},
+    {"INC zp LDA zp", 2, {0xE6, 0xA5}, {0, 2}, 4, 8},
+    {"BIT abs BPL", 2, {0x2C, 0x10}, {0, 3}, 5, 8},
+};
+
+//the rest of idiom follows the opcode just fetched, in the same page of PRG-ROM
+inline bool CPU::matches(const Idiom &idiom) const {
+    if (!code || ((PC - 1) & 0x1FFF) + idiom.length > 0x2000) {
+        return false;
+    }
+    for (int k = 1; k < idiom.count; k++) {
+        if (code[idiom.at[k] - 1] != idiom.ops[k]) {
+            return false;
+        }
     }
+    return true;
+}
 
-    template <Mode m>
-    void DCP() {
-        G;
-        wr(a, p--);
+//what exec does between two instructions, inside an idiom
+inline void CPU::fused_next() {
+#ifdef NES_PROFILE
+    if (profiler) {
+        profile(opPC, opStart);
     }
+    opPC = PC;
+    opStart = cycles;
+#endif
+    opCode = fetch();
+}
 
-    void NOP() { T; }
-
-    template <Mode m>
-    void NOP() {
-        u8 addr = m();
-        rd(addr);
-        T;
+/**
+ * the handler of idiom i's first opcode: the idiom's handlers back to
+ * back, so the bus sees the same accesses on the same cycles.  Leaving
+ * out the run loop's checks in between is only the same when nothing can
+ * come up there, so all of it has to fit before the next PPU or APU
+ * event, else only the first instruction runs
+ */
+template<int i, CPU::Op first, CPU::Op... rest>
+void CPU::fuse() {
+    const Idiom &idiom = idioms[i];
+    if (!fusion || !matches(idiom)) {
+        (this->*first)();
+        return;
+    }
+    bool room = ppu.targetClock + 3 * idiom.maxCycles < ppu.eventClock &&
+                cycles + idiom.maxCycles < apu.eventClock;
+#ifdef NES_PROFILE
+    if (profiler) {
+        profiler->fusion(i, idiom.name, room);
+    }
+#endif
+    (this->*first)();
+    if (room) {
+        ((fused_next(), (this->*rest)()), ...);
+    }
+}
+
+/*
+ * Idle loops.  Most games wait for the next frame spinning on a RAM flag
+ * the NMI handler sets, or on the vblank bit of $2002.  Such a loop reads
+ * the same memory every time round and leaves the registers the same, so
+ * until the PPU or APU does something there is nothing to see: when a
+ * backward branch (or jump) lands on the same place twice running with
+ * the same registers and the loop only does side effect free reads, all
+ * the iterations that fit before the next event are skipped at once, the
+ * clocks moved on by exactly the cycles they would have taken.
+ */
+inline void CPU::idle_loop(u16 end) {
+#ifdef NES_PROFILE
+    if (profiler) {
+        return;
+    }
+#endif
+    if (!idleSkip || traceLog) {
+        return;
+    }
+    u8 regs[5] = {A, X, Y, S, P.get()};
+    if (PC != idleTop || end != idleEnd) {
+        idleTop = PC;
+        idleEnd = end;
+        idleKind = -1;
+    } else if (idleCycles >= 0 && !memcmp(regs, idleRegs, sizeof(regs))) {
+        if (idleKind < 0) {
+            idleKind = idle_body(idleTop, idleEnd);
+        }
+        if (idleKind) {
+            skip_idle(cycles - idleCycles);
+        }
     }
+    memcpy(idleRegs, regs, sizeof(regs));
+    idleCycles = cycles;
+}
 
-    void exec() {
-        opCode = rd(PC++);
-        if (debug) {
-            std::cout << " Program Counter " << std::hex << PC % 0x8000;
-            std::cout << " performing OP code " << std::hex << (int) opCode;
-            std::cout << " A = " << (int) A << " X = " << (int) X << " Y = " << (int) Y;
-            std::cout << " P =  " << std::hex << (int) P.get();
-            std::cout << " S = " << std::hex << (int) S << std::endl;
-        } if (test2) {
-            printf("%04X ", PC - 1);
-//            std::cout << " " << std::hex << (int) rd(PC);
-//            std::cout << " A:" << (int) A << " X:" << (int) X << " Y:" << (int) Y;
-            printf("%02X A:%02X X:%02X Y:%02X P:%02X SP:%02X \n",opCode, A, X, Y, P.get(), S);
-//            std::cout << " CYC:" << std::to_string(PPU::getCycle());
-//            std::cout << " SL:" << std::to_string(PPU::getScanline()) << std::endl;
+/**
+ * true if the code from top up to the branch or jump at end only reads
+ * memory that can't change or have side effects while nothing happens:
+ * loads, BIT, compares and AND #imm from RAM or the cartridge.  Reading
+ * $2002 is fine too in the one shape where only vblank can end the loop,
+ * a load or BIT of it straight followed by BPL
+ */
+bool CPU::idle_body(u16 top, u16 end) {
+    u16 pc = top;
+    int count = 0;
+    bool status = false;
+    while (pc != end) {
+        if (pc > end || ++count > 4) {
+            return false;
         }
-        switch (opCode) {
-
-            case 0x03:
-                return SLO<izx>();
-            case 0x14:
-                return DOP<zpx>();
-            case 0x1A:
-                return NOP();
-            case 0x1C:
-                return TOP();
-            /*Storage OPs */
-            //LDA
-            case 0xA9:
-                return LDA<imm>();
-            case 0xA5:
-                return LDA<zp>();
-            case 0xB5:
-                return LDA<zpx>();
-            case 0xAD:
-                return LDA<abs>();
-            case 0xBD:
-                return LDA<abx>();
-            case 0xB9:
-                return LDA<aby>();
-            case 0xA1:
-                return LDA<izx>();
-            case 0xB1:
-                return LDA<izy>();
-                //LDX
-            case 0xA2:
-                return LDX<imm>();
-            case 0xA6:
-                return LDX<zp>();
-            case 0xB6:
-                return LDX<zpy>();
-            case 0xAE:
-                return LDX<abs>();
-            case 0xBE:
-                return LDX<aby>();
-                //LDY
-            case 0xA0:
-                return LDY<imm>();
-            case 0xA4:
-                return LDY<zp>();
-            case 0xB4:
-                return LDY<zpx>();
-            case 0xAC:
-                return LDY<abs>();
-            case 0xBC:
-                return LDY<abx>();
-
-                //STA
-            case 0x85:
-                return st<A, zp>();
-            case 0x95:
-                return st<A, zpx>();
-            case 0x8D:
-                return st<A, abs>();
-            case 0x9D:
-                return st<A, abx>();
-            case 0x99:
-                return st<A, aby>();
-            case 0x81:
-                return st<A, izx>();
-            case 0x91:
-                return st<A, izy>();
-
-                //STX
-            case 0x86:
-                return st<X, zp>();
-            case 0x96:
-                return st<X, zpy>();
-            case 0x8E:
-                return st<X, abs>();
-
-                //STY
-            case 0x84:
-                return st<Y, zp>();
-            case 0x94:
-                return st<Y, zpx>();
-            case 0x8C:
-                return st<Y, abs>();
-
-                //TAY
-            case 0xA8:
-                return tr<A, Y>();
-
-                //TAX
-            case 0xAA:
-                return tr<A, X>();
-
-                //TSX
-            case 0xBA:
-                return tr<S, X>();
-
-                //TXA
-            case 0x8A:
-                return tr<X, A>();
-
-                //TXS
-            case 0x9A:
-                return tr<X, S>();
-
-                //TYA
-            case 0x98:
-                return tr<Y, A>();
-
-                //ADC
-            case 0x69:
-                return ADC<imm>();
-            case 0x65:
-                return ADC<zp>();
-            case 0x75:
-                return ADC<zpx>();
-            case 0x6D:
-                return ADC<abs>();
-            case 0x7D:
-                return ADC<abx>();
-            case 0x79:
-                return ADC<aby>();
-            case 0x61:
-                return ADC<izx>();
-            case 0x71:
-                return ADC<izy>();
-
-                //SBC
-            case 0xE9:
-                return SBC<imm>();
-            case 0xE5:
-                return SBC<zp>();
-            case 0xF5:
-                return SBC<zpx>();
-            case 0xED:
-                return SBC<abs>();
-            case 0xFD:
-                return SBC<abx>();
-            case 0xF9:
-                return SBC<aby>();
-            case 0xE1:
-                return SBC<izx>();
-            case 0xF1:
-                return SBC<izy>();
-
-                //DEC
-            case 0xC6:
-                return DEC<zp>();
-            case 0xD6:
-                return DEC<zpx>();
-            case 0xCE:
-                return DEC<abs>();
-            case 0xDE:
-                return DEC<_abx>(); // use _abx because we always Tick to check
-                // if writing to right mem location page
-                // cross
-
-                //DEX
-            case 0xCA:
-                return DEX();
-
-                //DEY
-            case 0x88:
-                return DEY();
-
-                //INC
-            case 0xE6:
-                return INC<zp>();
-            case 0xF6:
-                return INC<zpx>();
-            case 0xEE:
-                return INC<abs>();
-            case 0xFE:
-                return INC<_abx>(); //Tick regardless of page cross
-
-                //INX
-            case 0xE8:
-                return INX();
-
-                //INY
-            case 0xC8:
-                return INY();
-
-                //AND
-            case 0x29:
-                return AND<imm>();
-            case 0x25:
-                return AND<zp>();
-            case 0x35:
-                return AND<zpx>();
-            case 0x2D:
-                return AND<abs>();
-            case 0x3D:
-                return AND<abx>();
-            case 0x39:
-                return AND<aby>();
-            case 0x21:
-                return AND<izx>();
-            case 0x31:
-                return AND<_izy>(); //
-
-                //ASL
-            case 0x0A:
-                return ASL();
-            case 0x06:
-                return ASL<zp>();
-            case 0x16:
-                return ASL<zpx>();
-            case 0x0E:
-                return ASL<abs>();
-            case 0x1E:
-                return ASL<_abx>(); //Always tick when writing to mem (x page)
-
-                //BIT
-            case 0x24:
-                return BIT<zp>();
-            case 0x2C:
-                return BIT<abs>();
-
-                //EOR
-            case 0x49:
-                return EOR<imm>();
-            case 0x45:
-                return EOR<zp>();
-            case 0x55:
-                return EOR<zpx>();
-            case 0x4D:
-                return EOR<abs>();
-            case 0x5D:
-                return EOR<abx>();
-            case 0x59:
-                return EOR<aby>();
-            case 0x41:
-                return EOR<izx>();
-            case 0x51:
-                return EOR<izy>();
-
-                //LSR
-            case 0x4A:
-                return LSR();
-            case 0x46:
-                return LSR<zp>();
-            case 0x56:
-                return LSR<zpx>();
-            case 0x4E:
-                return LSR<abs>();
-            case 0x5E:
-                return LSR<_abx>();
-
-                //ORA
-            case 0x09:
-                return ORA<imm>();
-            case 0x05:
-                return ORA<zp>();
-            case 0x15:
-                return ORA<zpx>();
-            case 0x0D:
-                return ORA<abs>();
-            case 0x1D:
-                return ORA<abx>();
-            case 0x19:
-                return ORA<aby>();
-            case 0x01:
-                return ORA<izx>();
-            case 0x11:
-                return ORA<_izy>();
-
-                //ROL
-            case 0x2A:
-                return ROL();
-            case 0x26:
-                return ROL<zp>();
-            case 0x36:
-                return ROL<zpx>();
-            case 0x2E:
-                return ROL<abs>();
-            case 0x3E:
-                return ROL<_abx>();
-
-                //ROR
-            case 0x6A:
-                return ROR();
-            case 0x66:
-                return ROR<zp>();
-            case 0x76:
-                return ROR<zpx>();
-            case 0x6E:
-                return ROR<abs>();
-            case 0x7E:
-                return ROR<_abx>();
-
-                /*Stack Operations */
-            case 0x48:
-                return PHA();
-            case 0x08:
-                return PHP();
-            case 0x68:
-                return PLA();
-            case 0x28:
-                return PLP();
-
-                //BRANCH
-            case 0x90:
-                return BCC();
-            case 0xB0:
-                return BCS();
-            case 0xF0:
-                return BEQ();
-            case 0x30:
-                return BMI();
-            case 0xD0:
-                return BNE();
-            case 0x10:
-                return BPL();
-            case 0x50:
-                return BVC();
-            case 0x70:
-                return BVS();
-
-                //JMP
-            case 0x4C:
-                return JMP();
-            case 0x6C:
-                return i_JMP();
-            case 0x20:
-                return JSR();
-            case 0x40:
-                return RTI();
-            case 0x60:
-                return RTS();
-            case 0x00:
-                return BRK();
-
-                //Flag Setting and Clearing
-            case 0x18:
-                return cl<C>(); //clear
-            case 0xD8:
-                return cl<D>();
-            case 0x58:
-                return cl<I>();
-            case 0xB8:
-                return cl<V>();
-            case 0x38:
-                return set<C>(); //set
-            case 0xF8:
-                return set<D>();
-            case 0x78:
-                return set<I>();
-
-                //Compare OPS
-                //Compare against A (CMP)
-            case 0xC9:
-                return cmp<A, imm>();
-            case 0xC5:
-                return cmp<A, zp>();
-            case 0xD5:
-                return cmp<A, zpx>();
-            case 0xCD:
-                return cmp<A, abs>();
-            case 0xDD:
-                return cmp<A, abx>();
-            case 0xD9:
-                return cmp<A, aby>();
-            case 0xC1:
-                return cmp<A, izx>();
-            case 0xD1:
-                return cmp<A, izy>();
-
-                //Compare X (CPX)
-            case 0xE0:
-                return cmp<X, imm>();
-            case 0xE4:
-                return cmp<X, zp>();
-            case 0xEC:
-                return cmp<X, abs>();
-
-                //Compare Y (CPY)
-            case 0xC0:
-                return cmp<Y, imm>();
-            case 0xC4:
-                return cmp<Y, zp>();
-            case 0xCC:
-                return cmp<Y, abs>();
-
-            //NOP
-            case 0xEA:
-                return NOP();
-            case 0x44:
-                return NOP<zp>();
-            case 0x64:
-                return NOP<zp>();
-            case 0x0C:
-                return NOP<abs>();
-            case 0x34:
-                return NOP<zpx>();
-            case 0x54:
-                return NOP<zpx>();
-            case 0x74:
-                return NOP<zpx>();
-            case 0xD4:
-                return NOP<zpx>();
-            case 0xF4:
-                return NOP<zpx>();
-            case 0x3A:
-                return NOP();
-            case 0x5A:
-                return NOP();
-            case 0x7A:
-                return NOP();
-            case 0xDA:
-                return NOP();
-            case 0xFA:
-                return NOP();
-            case 0x80:
-                return NOP<imm>();
-            case 0x89:
-                return NOP<imm>();
-
-
-                //Unofficial
-            case 0x04:
-                PC++;
-                return NOP();
-            case 0xFF:
-                //return exit(1);
-                exit(0);
-                //return ISC<abx>();
-            case 0xCF:
-                return DCP<abs>();
-            case 0xD3:
-                return DCP<izy>();
-            case 0xD7:
-                 return DCP<zpx>();
-            case 0xDB:
-                return DCP<aby>();
-            case 0xDF:
-                return DCP<abx>();
-            case 0xC7:
-                return DCP<zp>();
-
-            case 0xD2:
-                exit(1);
-
-
-            default:
-                NOP();
-                if (debug == false) {
-                    std::cout << "undefined op" << std::endl;
-                    std::cout << "Op code - " << std::hex << (int) rd(PC - 1) << std::endl;
-                    //std::cout << "program counter value = " << (int) PC << std::endl;
+        u8 op = peek(pc);
+        switch (op) {
+            case 0xA5: case 0xA6: case 0xA4: case 0x24: // LDA LDX LDY BIT zp
+            case 0xC5: case 0xE4: case 0xC4:             // CMP CPX CPY zp
+            case 0xC9: case 0xE0: case 0xC0: case 0x29:  // CMP CPX CPY AND #imm
+                pc += 2;
+                break;
+            case 0xAD: case 0xAE: case 0xAC: case 0x2C: // LDA LDX LDY BIT abs
+            case 0xCD: case 0xEC: case 0xCC: {           // CMP CPX CPY abs
+                u16 addr = peek(pc + 1) | peek(pc + 2) << 8;
+                if (addr == 0x2002 && op != 0xCD && op != 0xEC && op != 0xCC) {
+                    status = true;
+                } else if (addr >= 0x2000 && addr < 0x6000) {
+                    return false;
                 }
+                pc += 3;
+                break;
+            }
+            default:
+                return false;
         }
     }
+    return !status || (count == 1 && peek(end) == 0x10);
+}
 
-    void set_nmi(bool v) { nmi = v; }
-
-    void set_irq(bool v) { irq = v; }
-
-    /**
-     * reset interrupt
-     */
-    void reset() {
-        S -= 3;
-        set_irq();
-        P[I] = 1;
-        T;
-        T;
-        T;
-        T;
-        T;
-        PC = rd16(0xFFFC);
-//        PC = 0xC000;
+void CPU::skip_idle(s64 length) {
+    if (nmi || (irq && !P[I]) || length <= 0) {
+        return;
     }
-
-    /**
-     * regular interrupt request
-     */
-    void irq_interrupt() {
-        T;
-        T;
-        push(PC >> 8);
-        push(PC & 0xFF);
-        push(P.get());
-        PC = rd16(0xFFFE);
+    // the run loop must still see the events when they come due
+    s64 room = std::min((ppu.eventClock - 1 - ppu.targetClock) / 3, apu.eventClock - 1 - cycles);
+    if (room < length) {
+        return;
     }
+    s64 skip = room / length * length;
+    cycles += skip;
+    ppu.targetClock += 3 * skip;
+    idleSkipped += skip;
+}
 
-    /**
-     * non maskable interrupt
-     */
-    void nmi_interrupt() {
-        T;
-        T;
-        push(PC >> 8);
-        push(PC);
-        push(P.get());
-        PC = rd16(0xFFFA);
-        nmi = false;
+/**
+ * memory as the CPU would read it, minus the side effects: registers
+ * read as 0 so tracing can't change what the program sees
+ */
+u8 CPU::peek(u16 addr) {
+    if (addr < 0x2000) {
+        return ram[addr % 0x800];
+    } else if (addr >= 0x8000) {
+        return cartridge.prg_read(addr);
+    } else if (addr >= 0x6000) {
+        return cartridge.access<false>(addr);
     }
+    return 0;
+}
+
+/**
+ * record the CPU state for the op about to run, only called from the
+ * traced interpreter loop.  The PPU position is worked out rather than
+ * synced to, so the PPU keeps drawing whole lines
+ */
+void CPU::trace() {
+    TraceRecord &r = traceLog->next();
+    r.cycles = cycles;
+    r.pc = PC;
+    r.bytes[0] = peek(PC);
+    r.bytes[1] = peek(PC + 1);
+    r.bytes[2] = peek(PC + 2);
+    r.a = A;
+    r.x = X;
+    r.y = Y;
+    r.p = P.get();
+    r.s = S;
+    int line, dot;
+    ppu.target_position(line, dot);
+    r.scanline = line;
+    r.dot = dot;
+}
+
+template<bool traced>
+inline void CPU::exec() {
+#ifdef NES_PROFILE
+    opPC = PC;
+    opStart = cycles;
+#endif
+    if (traced) {
+        trace();
+    }
+    // PRG-ROM is read through the page table of the banks switched in now,
+    // unless the instruction runs over into the next page
+    if (PC >= 0x8000 && (PC & 0x1FFF) < 0x1FFE) {
+        code = cartridge.mapper->prg_pages()[(PC >> 13) & 3] + (PC & 0x1FFF);
+    } else {
+        code = nullptr;
+    }
+    opCode = fetch();
+    // every instruction on its own when traced
+    (this->*(traced ? opTable.op : opTable.fused)[opCode])();
+#ifdef NES_PROFILE
+    if (profiler) {
+        profile(opPC, opStart);
+    }
+#endif
+}
+
+#ifdef NES_PROFILE
+/**
+ * the instruction just run, and the shadow call stack: JSR and BRK go
+ * into a frame for where they landed, RTS and RTI come back out
+ */
+void CPU::profile(u16 pc, s64 start) {
+    const Mapper &mapper = *cartridge.mapper;
+    profiler->instruction(Profiler::location(pc, mapper), pc, cycles - start);
+    switch (opCode) {
+        case 0x00:
+        case 0x20:
+            profiler->call(Profiler::location(PC, mapper), PC);
+            break;
+        case 0x40:
+        case 0x60:
+            profiler->ret();
+            break;
+    }
+}
+
+//the 7 cycles of taking an interrupt go to the handler's frame
+void CPU::profile_interrupt(s64 start) {
+    profiler->call(Profiler::location(PC, *cartridge.mapper), PC, cycles - start);
+}
+#endif
+
+void CPU::set_nmi(bool v) { nmi = v; }
+
+void CPU::set_irq(bool v) { irq = v; }
+
+/**
+ * reset interrupt
+ */
+void CPU::reset() {
+    jammed = false;
+    S -= 3;
+    P[I] = 1;
+    T;
+    T;
+    T;
+    T;
+    T;
+    PC = rd16(0xFFFC);
+//        PC = 0xC000;
+}
 
-    /**
-     * set up CPU state on start
-     */
-    void power() {
-        A = 0;
-        X = 0;
-        Y = 0;
-        P.set(0x34);
-        remainingCycles = 0;
-        S = 0x00; //When reset is done sets to 0xFD like expected
-        memset(ram, 0xFF, sizeof(ram));
+/**
+ * regular interrupt request
+ */
+void CPU::irq_interrupt() {
+    idleCycles = -1;
+    T;
+    T;
+    push(PC >> 8);
+    push(PC & 0xFF);
+    push(P.get());
+    PC = rd16(0xFFFE);
+}
 
-        nmi = false;
-        irq = false;
-        //reset
+/**
+ * non maskable interrupt
+ */
+void CPU::nmi_interrupt() {
+    idleCycles = -1;
+    T;
+    T;
+    push(PC >> 8);
+    push(PC);
+    push(P.get());
+    PC = rd16(0xFFFA);
+    nmi = false;
+}
+
+/**
+ * set up CPU state on start
+ */
+void CPU::power() {
+    A = 0;
+    X = 0;
+    Y = 0;
+    P.set(0x34);
+    cycles = 0;
+    S = 0x00; //When reset is done sets to 0xFD like expected
+    memset(ram, 0xFF, sizeof(ram));
+
+    nmi = false;
+    irq = false;
+    idleTop = idleEnd = 0;
+    idleKind = -1;
+    idleCycles = -1;
+    // a new cartridge, so blocks compiled for the old one are no good
+    if (jit) {
+        delete jit;
+        jit = new Jit(*cartridge.mapper);
+    }
+    //reset
+
+    reset();
+}
 
-        reset();
+/**
+ * interpreter loop, the traced and untraced versions are separate
+ * instantiations so the common case never checks for a trace log
+ */
+template<bool traced>
+void CPU::run() {
+    for (;;) {
+        /* catch the PPU up if it is about to raise NMI, that is where frames end */
+        if (ppu.targetClock >= ppu.eventClock) {
+            ppu.sync();
+            if (ppu.frame_done()) {
+                return;
+            }
+        }
+        /* same for the APU's IRQs and DMC fetches, which also take cycles from us */
+        if (cycles >= apu.eventClock) {
+            apu.sync();
+            // stalled cycles aren't part of the loop being timed for idle_loop
+            if (apu.stall > 0) {
+                idleCycles = -1;
+            }
+            for (; apu.stall > 0; apu.stall--) {
+                T;
+            }
+        }
+        /* time still passes for the rest of the console, interrupts go unanswered */
+        if (jammed) {
+            T;
+            continue;
+        }
+        /*interrupt */
+#ifdef NES_PROFILE
+        s64 start = cycles;
+#endif
+        if (nmi) {
+            nmi_interrupt();
+#ifdef NES_PROFILE
+            if (profiler) {
+                profile_interrupt(start);
+            }
+#endif
+        }
+            /*other interrupt: also do stuff */
+        else if (irq and !P[I]) {
+            irq_interrupt();
+#ifdef NES_PROFILE
+            if (profiler) {
+                profile_interrupt(start);
+            }
+#endif
+        }
+        if (!traced && jit && run_block()) {
+            continue;
+        }
+        exec<traced>();
     }
+}
 
-    void run_frame() {
+bool CPU::set_jit(bool on, bool check) {
+    delete jit;
+    jit = nullptr;
+    jitCheck = check;
+    if (on) {
+        if (!Jit::available()) {
+            return false;
+        }
+        jit = new Jit(*cartridge.mapper);
+    }
+    return true;
+}
 
-        remainingCycles += TOTAL_CYCLES;
+/**
+ * run the compiled block at PC in place of the next instruction, if there
+ * is one and even its longest run ends before the next PPU or APU event
+ * is due, so the run loop misses nothing.  Left through its backward
+ * branch or jump it may be an idle loop, like in branch()
+ */
+inline bool CPU::run_block() {
+#ifdef NES_PROFILE
+    if (profiler) {
+        return false;
+    }
+#endif
+    if (PC < 0x8000) {
+        return false;
+    }
+    const Jit::Block *b = jit->block(PC);
+    if (!b->code || ppu.targetClock + 3 * b->maxCycles >= ppu.eventClock ||
+        cycles + b->maxCycles >= apu.eventClock) {
+        return false;
+    }
+    u32 r = jitCheck ? check_block(b) : b->code(this);
+    u32 used = r & ~Jit::LOOPED;
+    if (used == 0) {
+        // it left before its first instruction, which is the interpreter's to run
+        return false;
+    }
+    cycles += used;
+    ppu.targetClock += 3 * used;
+    jitCycles += used;
+    if (r & Jit::LOOPED) {
+        idle_loop(b->loopAt);
+    }
+    return true;
+}
 
-        while (remainingCycles > 0) {
-            /*interrupt */
-            if (nmi) {
-                nmi_interrupt();
-            }
-                /*other interrupt: also do stuff */
-            else if (irq and !P[I]) {
-                irq_interrupt();
+/**
+ * run the block, then the same instructions through the interpreter from
+ * where the block started, and report what differs.  The interpreter's
+ * state is the one kept, with the clocks put back for run_block to move
+ * on.  Idle loops aren't skipped and idioms aren't fused inside so both
+ * run the same cycles
+ */
+u32 CPU::check_block(const Jit::Block *b) {
+    CPUState before = *this;
+    s64 target = ppu.targetClock;
+    u32 r = b->code(this);
+    CPUState compiled = *this;
+    s64 end = cycles + (r & ~Jit::LOOPED);
+
+    *static_cast<CPUState *>(this) = before;
+    bool skip = idleSkip, fuse = fusion;
+    idleSkip = false;
+    fusion = false;
+    while (cycles < end) {
+        exec<false>();
+    }
+    idleSkip = skip;
+    fusion = fuse;
+
+    bool same = A == compiled.A && X == compiled.X && Y == compiled.Y && S == compiled.S &&
+                PC == compiled.PC && P.get() == compiled.P.get() && cycles == end && opCode == compiled.opCode;
+    int diff = 0;
+    while (diff < 0x800 && ram[diff] == compiled.ram[diff]) {
+        diff++;
+    }
+    if (!same || diff < 0x800) {
+        if (++jitMismatches <= 10) {
+            fprintf(stderr, "jit: block at %04X ran differently\n", b->pc);
+            fprintf(stderr, "  compiled     PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lld\n",
+                    compiled.PC, compiled.A, compiled.X, compiled.Y, compiled.P.get(), compiled.S,
+                    (long long) (before.cycles + (r & ~Jit::LOOPED)));
+            fprintf(stderr, "  interpreter  PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lld\n",
+                    PC, A, X, Y, P.get(), S, (long long) cycles);
+            if (diff < 0x800) {
+                fprintf(stderr, "  RAM first differs at $%03X: %02X compiled, %02X interpreted\n",
+                        diff, compiled.ram[diff], ram[diff]);
             }
-            exec();
         }
+        // carry on from the interpreter's state, run_block adds the cycles back
+        r = (cycles - before.cycles) | (r & Jit::LOOPED);
+    }
+    cycles = before.cycles;
+    ppu.targetClock = target;
+    return r;
+}
+
+/**
+ * run until the PPU reaches vblank, so a frame always ends at the same
+ * point of the picture and the NMI it raises is handled by the next one
+ */
+void CPU::run_frame() {
+    if (traceLog) {
+        run<true>();
+    } else {
+        run<false>();
     }
-} // namespace CPU
+}
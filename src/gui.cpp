@@ -1,10 +1,15 @@
 //
 // Created by Brian Bonafilia on 6/3/21.
 //
+#include <atomic>
+#include <cstring>
 #include <iostream>
 #include "include/gui.hpp"
-#include "include/cpu.hpp"
-#include "include/cartridge.hpp"
+#include "include/audio_ring.hpp"
+#include "include/console.hpp"
+#include "include/movie.hpp"
+#include "include/rewind.hpp"
+#include "include/pacer.hpp"
 
 #include "include/SDL2/SDL.h"
 #include "include/SDL2/SDL_timer.h"
@@ -24,8 +29,27 @@ namespace GUI {
 
     controller_status status;
 
-    void update_frame(u32* pixels) {
-        SDL_UpdateTexture(gamePixels, NULL, pixels, PIXEL_WIDTH * sizeof(u32));
+    // held down to run time backwards
+    bool rewinding = false;
+
+    const int SAMPLE_RATE = 48000;
+
+    // device callbacks that ran out of samples
+    std::atomic<int> underruns{0};
+
+    /**
+     * runs on SDL's audio thread: only takes what the emulation thread
+     * already pushed, and plays silence if it has fallen behind
+     */
+    void audio_callback(void *userdata, Uint8 *stream, int len) {
+        AudioRing *ring = static_cast<AudioRing *>(userdata);
+        s16 *out = reinterpret_cast<s16 *>(stream);
+        size_t wanted = len / sizeof(s16);
+        size_t got = ring->pop(out, wanted);
+        if (got < wanted) {
+            underruns++;
+            memset(out + got, 0, (wanted - got) * sizeof(s16));
+        }
     }
 
     void render() {
@@ -34,13 +58,22 @@ namespace GUI {
         SDL_RenderPresent(renderer);
     }
 
-    u8 getControllerStatus() {
-        u8 val = status.state;
-        return val;
-    }
+    int init(Console &console, const Options &options) {
+        // movies from power on: frame counts the frames run since, the
+        // session is always recorded (two bytes a frame) and follows
+        // rewinding back, it is only saved with options.record
+        Movie play, record;
+        if (options.play && !play.load(options.play)) {
+            fprintf(stderr, "%s is not a movie\n", options.play);
+            return 1;
+        }
+        if (options.play && play.romHash != console.cartridge.rom_hash()) {
+            fprintf(stderr, "warning: %s was recorded with a different ROM\n", options.play);
+        }
+        record.romHash = console.cartridge.rom_hash();
+        size_t frame = 0;
 
-    int init() {
-        if(SDL_Init(SDL_INIT_VIDEO) < 0) {
+        if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
             printf("failed to init video");
             return -1;
         }
@@ -60,22 +93,74 @@ namespace GUI {
             return 1;
         }
 
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        // one clock paces frames, either ours or the display's
+        u32 flags = SDL_RENDERER_ACCELERATED;
+        if (options.sync == FramePacer::vsync) {
+            flags |= SDL_RENDERER_PRESENTVSYNC;
+        }
+        renderer = SDL_CreateRenderer(window, -1, flags);
 
         SDL_RenderSetLogicalSize(renderer, PIXEL_WIDTH, PIXEL_HEIGHT);
         gamePixels = SDL_CreateTexture(renderer,
                                        SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING,
                                        PIXEL_WIDTH, PIXEL_HEIGHT);
 
-        u32 startFrame, endFrame, timeToRunFrame;
+        // about 170ms of sound, made before the device starts so the
+        // emulation thread never allocates for it.  Playing starts once
+        // the ring holds the target, which leaves room to drift both ways.
+        AudioRing ring(8192);
+        const size_t audioTarget = 2400;
+        RateControl rate(audioTarget);
+        bool playing = false;
+        SDL_AudioSpec want = {}, have;
+        want.freq = SAMPLE_RATE;
+        want.format = AUDIO_S16SYS;
+        want.channels = 1;
+        want.samples = 512;
+        want.callback = audio_callback;
+        want.userdata = &ring;
+        SDL_AudioDeviceID audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+        if (audio == 0) {
+            fprintf(stderr, "no sound: %s\n", SDL_GetError());
+        } else {
+            console.apu.set_output(&ring, have.freq);
+        }
+
         const int frameRate = 60;
-        int delay = 1000 / frameRate;
         SDL_Event event;
         bool is_running = true;
+        Rewind rewind(10 * frameRate);
+        FramePacer pacer(options.sync);
 
         while (is_running) {
-            startFrame = SDL_GetTicks();
-            CPU::run_frame();
+            if (!rewinding || !rewind.step_back(console)) {
+                u8 port0 = status.state, port1 = 0;
+                if (frame < play.frames()) {
+                    port0 = play.buttons(frame, 0);
+                    port1 = play.buttons(frame, 1);
+                } else if (options.play && frame == play.frames()) {
+                    fprintf(stderr, "end of %s, over to the keyboard\n", options.play);
+                }
+                console.set_input(0, port0);
+                console.set_input(1, port1);
+                record.record(port0, port1);
+                console.run_frame_ahead(options.runAhead);
+                rewind.push(console);
+                frame++;
+            } else {
+                frame--;
+                record.truncate(frame);
+            }
+            if (audio != 0) {
+                if (!playing && ring.size() >= audioTarget) {
+                    playing = true;
+                    SDL_PauseAudioDevice(audio, 0);
+                }
+                if (playing && options.sync == FramePacer::audio) {
+                    console.apu.set_rate_ratio(rate.update(ring.size()));
+                }
+            }
+            SDL_UpdateTexture(gamePixels, NULL, console.frame(), PIXEL_WIDTH * sizeof(u32));
             while (SDL_PollEvent(&event)) {
                 if (event.type == SDL_QUIT) {
                     is_running = false;
@@ -105,6 +190,9 @@ namespace GUI {
                         case SDLK_c:
                             status.controllerState.select = 1;
                             break;
+                        case SDLK_BACKSPACE:
+                            rewinding = true;
+                            break;
                     }
                 } else if (event.type == SDL_KEYUP) {
                     switch (event.key.keysym.sym) {
@@ -132,18 +220,32 @@ namespace GUI {
                         case SDLK_c:
                             status.controllerState.select = 0;
                             break;
+                        case SDLK_BACKSPACE:
+                            rewinding = false;
+                            break;
                     }
                 }
             }
-            endFrame = SDL_GetTicks();
-            timeToRunFrame = endFrame - startFrame;
-            if (timeToRunFrame < delay) {
-                SDL_Delay(delay - timeToRunFrame);
-            }
+            pacer.wait();
             render();
         }
+        FramePacer::Stats stats = pacer.stats();
+        fprintf(stderr, "last %d frames: %.3f ms average, jitter p99 %.3f ms, max %.3f ms\n",
+                stats.frames, stats.meanMs, stats.p99JitterMs, stats.maxJitterMs);
+        if (audio != 0) {
+            fprintf(stderr, "sound: %d underruns, buffer %.0f samples, rate x%.5f\n",
+                    underruns.load(), rate.fill(), rate.ratio());
+        }
+        if (audio != 0) {
+            SDL_CloseAudioDevice(audio);
+            console.apu.set_output(nullptr, 0);
+        }
         SDL_DestroyWindow(window);
         SDL_Quit();
+        if (options.record && !record.save(options.record)) {
+            fprintf(stderr, "could not write %s\n", options.record);
+            return 1;
+        }
         return 0;
     }
 }
\ No newline at end of file
@@ -0,0 +1,416 @@
+//
+// Headless front end: runs a ROM for a fixed number of frames as fast as
+// possible, with no window, no frame pacing and no SDL.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "include/audio_ring.hpp"
+#include "include/console.hpp"
+#include "include/movie.hpp"
+#include "include/pacer.hpp"
+#include "include/profiler.hpp"
+#include "include/trace.hpp"
+
+#define PIXEL_WIDTH 256
+#define PIXEL_HEIGHT 240
+
+namespace {
+
+    u32 crc_table[256];
+
+    u32 crc32(u32 crc, const u8 *data, size_t len) {
+        if (crc_table[1] == 0) {
+            for (u32 n = 0; n < 256; n++) {
+                u32 c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                crc_table[n] = c;
+            }
+        }
+        crc = ~crc;
+        for (size_t i = 0; i < len; i++) {
+            crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void put32(u8 *p, u32 v) {
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+    }
+
+    void write_chunk(FILE *f, const char *type, const u8 *data, u32 len) {
+        u8 header[8];
+        put32(header, len);
+        memcpy(header + 4, type, 4);
+        u32 crc = crc32(crc32(0, header + 4, 4), data, len);
+        u8 trailer[4];
+        put32(trailer, crc);
+        fwrite(header, 1, 8, f);
+        fwrite(data, 1, len, f);
+        fwrite(trailer, 1, 4, f);
+    }
+
+    /**
+     * Write the frame as an RGB PNG.  The image data goes in stored
+     * (uncompressed) deflate blocks so we don't need zlib.
+     */
+    bool write_png(const char *fileName, const u32 *pixels) {
+        FILE *f = fopen(fileName, "wb");
+        if (f == NULL) {
+            return false;
+        }
+        const u32 rowSize = PIXEL_WIDTH * 3 + 1;
+        const u32 rawSize = rowSize * PIXEL_HEIGHT;
+        u8 *raw = new u8[rawSize];
+        for (int y = 0; y < PIXEL_HEIGHT; y++) {
+            u8 *row = raw + y * rowSize;
+            *row++ = 0; // no filter
+            for (int x = 0; x < PIXEL_WIDTH; x++) {
+                u32 c = pixels[y * PIXEL_WIDTH + x];
+                *row++ = c >> 16;
+                *row++ = c >> 8;
+                *row++ = c;
+            }
+        }
+
+        const u32 maxBlock = 0xFFFF;
+        u32 blocks = (rawSize + maxBlock - 1) / maxBlock;
+        u32 zSize = 2 + blocks * 5 + rawSize + 4;
+        u8 *z = new u8[zSize];
+        u8 *p = z;
+        *p++ = 0x78;
+        *p++ = 0x01;
+        u32 a = 1, b = 0;
+        for (u32 done = 0; done < rawSize;) {
+            u32 len = rawSize - done < maxBlock ? rawSize - done : maxBlock;
+            *p++ = done + len == rawSize ? 1 : 0;
+            *p++ = len;
+            *p++ = len >> 8;
+            *p++ = ~len;
+            *p++ = ~len >> 8;
+            memcpy(p, raw + done, len);
+            for (u32 i = 0; i < len; i++) {
+                a = (a + raw[done + i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            p += len;
+            done += len;
+        }
+        put32(p, (b << 16) | a);
+
+        static const u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        u8 ihdr[13];
+        put32(ihdr, PIXEL_WIDTH);
+        put32(ihdr + 4, PIXEL_HEIGHT);
+        ihdr[8] = 8;  // bit depth
+        ihdr[9] = 2;  // RGB
+        ihdr[10] = 0;
+        ihdr[11] = 0;
+        ihdr[12] = 0;
+        fwrite(signature, 1, 8, f);
+        write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+        write_chunk(f, "IDAT", z, zSize);
+        write_chunk(f, "IEND", NULL, 0);
+
+        delete[] raw;
+        delete[] z;
+        return fclose(f) == 0;
+    }
+
+    /**
+     * 16 bit mono WAV, the sizes in the header are filled in by
+     * finish_wav once we know them
+     */
+    void write_wav_header(FILE *f, int sampleRate, u32 dataSize) {
+        u8 header[44];
+        auto put = [&](int at, u32 v, int bytes) {
+            for (int i = 0; i < bytes; i++) {
+                header[at + i] = v >> (8 * i);
+            }
+        };
+        memcpy(header, "RIFF", 4);
+        put(4, 36 + dataSize, 4);
+        memcpy(header + 8, "WAVEfmt ", 8);
+        put(16, 16, 4);
+        put(20, 1, 2);               // PCM
+        put(22, 1, 2);               // mono
+        put(24, sampleRate, 4);
+        put(28, sampleRate * 2, 4);  // bytes per second
+        put(32, 2, 2);               // bytes per frame
+        put(34, 16, 2);
+        memcpy(header + 36, "data", 4);
+        put(40, dataSize, 4);
+        fseek(f, 0, SEEK_SET);
+        fwrite(header, 1, sizeof(header), f);
+    }
+
+    void usage(const char *name) {
+        fprintf(stderr, "usage: %s rom.nes [-frames N] [-hash] [-png dir] [-every N] [-runahead N] [-pace] [-wav file]\n"
+                        "       [-profile file] [-folded file] [-trace file] [-trace-last N] [-play movie] [-record movie] [-no-idle]\n"
+                        "       [-no-fuse] [-jit] [-jit-check]\n", name);
+        fprintf(stderr, "  -frames N  number of frames to run (default 600, or the length of the -play movie)\n");
+        fprintf(stderr, "  -hash      print a hash of every frame\n");
+        fprintf(stderr, "  -png dir   write frames to dir/frame_NNNNNN.png\n");
+        fprintf(stderr, "  -every N   only hash/snapshot every Nth frame (default 1)\n");
+        fprintf(stderr, "  -runahead N  show each frame N frames ahead, like the GUI does\n");
+        fprintf(stderr, "  -pace      run at NTSC speed like the GUI and report frame time jitter\n");
+        fprintf(stderr, "  -wav file  record the sound to a 48kHz WAV file\n");
+        fprintf(stderr, "  -profile file  write the hottest guest code locations (needs make PROFILE=1)\n");
+        fprintf(stderr, "  -folded file   write cycles per guest call stack for flamegraph.pl\n");
+        fprintf(stderr, "  -trace file    record every instruction to file, nes_tracedump reads it\n");
+        fprintf(stderr, "  -trace-last N  only keep the last N instructions, written to the -trace file at the end\n");
+        fprintf(stderr, "  -play movie    feed the buttons recorded in movie to the game\n");
+        fprintf(stderr, "  -record movie  save the buttons of every frame as a movie\n");
+        fprintf(stderr, "  -no-idle       run idle loops instruction by instruction instead of skipping them\n");
+        fprintf(stderr, "  -no-fuse       run the idioms the CPU fuses one instruction at a time\n");
+        fprintf(stderr, "  -jit           run code from PRG-ROM compiled to native code (x86-64 only)\n");
+        fprintf(stderr, "  -jit-check     same, running every block through the interpreter as well and\n"
+                        "                 reporting any difference, exits with 2 if there was one\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *romName = NULL;
+    const char *pngDir = NULL;
+    const char *wavName = NULL;
+    const char *profileName = NULL;
+    const char *foldedName = NULL;
+    const char *traceName = NULL;
+    long traceLast = 0;
+    const char *playName = NULL;
+    const char *recordName = NULL;
+    long frames = -1;
+    long every = 1;
+    int runAhead = 0;
+    bool pace = false;
+    bool hashes = false;
+    bool idleSkip = true;
+    bool fusion = true;
+    bool jit = false, jitCheck = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-hash")) {
+            hashes = true;
+        } else if (!strcmp(argv[i], "-png") && i + 1 < argc) {
+            pngDir = argv[++i];
+        } else if (!strcmp(argv[i], "-every") && i + 1 < argc) {
+            every = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-wav") && i + 1 < argc) {
+            wavName = argv[++i];
+        } else if (!strcmp(argv[i], "-profile") && i + 1 < argc) {
+            profileName = argv[++i];
+        } else if (!strcmp(argv[i], "-folded") && i + 1 < argc) {
+            foldedName = argv[++i];
+        } else if (!strcmp(argv[i], "-trace") && i + 1 < argc) {
+            traceName = argv[++i];
+        } else if (!strcmp(argv[i], "-trace-last") && i + 1 < argc) {
+            traceLast = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-play") && i + 1 < argc) {
+            playName = argv[++i];
+        } else if (!strcmp(argv[i], "-record") && i + 1 < argc) {
+            recordName = argv[++i];
+        } else if (!strcmp(argv[i], "-no-idle")) {
+            idleSkip = false;
+        } else if (!strcmp(argv[i], "-no-fuse")) {
+            fusion = false;
+        } else if (!strcmp(argv[i], "-jit")) {
+            jit = true;
+        } else if (!strcmp(argv[i], "-jit-check")) {
+            jit = jitCheck = true;
+        } else if (!strcmp(argv[i], "-pace")) {
+            pace = true;
+        } else if (!strcmp(argv[i], "-runahead") && i + 1 < argc) {
+            runAhead = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && romName == NULL) {
+            romName = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (romName == NULL || frames < -1 || every < 1 || traceLast < 0 || (traceLast && !traceName)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+#ifndef NES_PROFILE
+    if (profileName || foldedName) {
+        fprintf(stderr, "built without the profiler, rebuild with make PROFILE=1\n");
+        return 1;
+    }
+#endif
+
+    Console *console = new Console();
+    if (!console->load(romName)) {
+        delete console;
+        return 1;
+    }
+
+    Movie play, record;
+    if (playName) {
+        if (!play.load(playName)) {
+            fprintf(stderr, "%s is not a movie\n", playName);
+            return 1;
+        }
+        if (play.romHash != console->cartridge.rom_hash()) {
+            fprintf(stderr, "warning: %s was recorded with a different ROM\n", playName);
+        }
+        if (frames < 0) {
+            frames = play.frames();
+        }
+    }
+    if (frames < 0) {
+        frames = 600;
+    }
+    record.romHash = console->cartridge.rom_hash();
+    console->cpu.set_idle_skip(idleSkip);
+    console->cpu.set_fusion(fusion);
+    if (jit && !console->cpu.set_jit(true, jitCheck)) {
+        fprintf(stderr, "no JIT on this machine\n");
+        return 1;
+    }
+
+    Profiler *profiler = NULL;
+#ifdef NES_PROFILE
+    if (profileName || foldedName) {
+        profiler = new Profiler(console->cartridge.mapper->prg_size());
+        console->cpu.set_profiler(profiler);
+    }
+#endif
+
+    FILE *traceFile = NULL;
+    TraceLog *trace = NULL;
+    if (traceName) {
+        traceFile = fopen(traceName, "wb");
+        if (traceFile == NULL) {
+            fprintf(stderr, "could not write %s\n", traceName);
+            return 1;
+        }
+        // streamed to the file as it goes, or only the tail kept in memory
+        trace = traceLast ? new TraceLog(traceLast) : new TraceLog(1 << 16, traceFile);
+        console->cpu.set_trace(trace);
+    }
+
+    const int sampleRate = 48000;
+    AudioRing ring(16384);
+    s16 samples[4096];
+    FILE *wav = NULL;
+    u32 wavBytes = 0;
+    if (wavName) {
+        wav = fopen(wavName, "wb");
+        if (wav == NULL) {
+            fprintf(stderr, "could not write %s\n", wavName);
+            return 1;
+        }
+        write_wav_header(wav, sampleRate, 0);
+        console->apu.set_output(&ring, sampleRate);
+    }
+
+    FramePacer pacer;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 1; i <= frames; i++) {
+        play.play(*console, i - 1);
+        if (recordName) {
+            record.record(play.buttons(i - 1, 0), play.buttons(i - 1, 1));
+        }
+        console->run_frame_ahead(runAhead);
+        if (wav) {
+            for (size_t n; (n = ring.pop(samples, sizeof(samples) / sizeof(samples[0]))) > 0;) {
+                wavBytes += fwrite(samples, sizeof(s16), n, wav) * sizeof(s16);
+            }
+        }
+        if (pace) {
+            pacer.wait();
+        }
+        if (i % every != 0) {
+            continue;
+        }
+        if (hashes) {
+            printf("frame %ld %016llx\n", i, (unsigned long long) console->frame_hash());
+        }
+        if (pngDir) {
+            char fileName[4096];
+            snprintf(fileName, sizeof(fileName), "%s/frame_%06ld.png", pngDir, i);
+            if (!write_png(fileName, console->frame())) {
+                fprintf(stderr, "could not write %s\n", fileName);
+                return 1;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (recordName && !record.save(recordName)) {
+        fprintf(stderr, "could not write %s\n", recordName);
+        return 1;
+    }
+    if (wav) {
+        write_wav_header(wav, sampleRate, wavBytes);
+        fclose(wav);
+    }
+    if (trace) {
+        console->cpu.set_trace(NULL);
+        if (traceLast) {
+            trace->save(traceFile);
+        }
+        fprintf(stderr, "%llu instructions traced\n", (unsigned long long) trace->recorded());
+        delete trace;
+        if (fclose(traceFile) != 0) {
+            fprintf(stderr, "could not write %s\n", traceName);
+            return 1;
+        }
+    }
+    const char *reports[2] = {profileName, foldedName};
+    for (int r = 0; r < 2 && profiler; r++) {
+        if (reports[r] == NULL) {
+            continue;
+        }
+        FILE *f = fopen(reports[r], "w");
+        if (f == NULL) {
+            fprintf(stderr, "could not write %s\n", reports[r]);
+            return 1;
+        }
+        if (r == 0) {
+            profiler->write_report(f);
+        } else {
+            profiler->write_folded(f);
+        }
+        fclose(f);
+    }
+
+    fprintf(stderr, "%ld frames in %.3f s, %.1f fps\n", frames, seconds, seconds > 0 ? frames / seconds : 0.0);
+    if (console->cpu.cycles > 0) {
+        fprintf(stderr, "%.1f%% of CPU cycles skipped in idle loops\n",
+                100.0 * console->cpu.idle_cycles_skipped() / console->cpu.cycles);
+    }
+    if (jit && console->cpu.cycles > 0) {
+        fprintf(stderr, "%.1f%% of CPU cycles run as compiled code, %llu blocks compiled\n",
+                100.0 * console->cpu.jit_cycles() / console->cpu.cycles,
+                (unsigned long long) console->cpu.jit_blocks());
+    }
+    if (jitCheck) {
+        fprintf(stderr, "%llu blocks ran differently from the interpreter\n",
+                (unsigned long long) console->cpu.jit_mismatches());
+    }
+    if (pace) {
+        FramePacer::Stats stats = pacer.stats();
+        fprintf(stderr, "last %d frames: %.3f ms average, jitter p99 %.3f ms, max %.3f ms\n",
+                stats.frames, stats.meanMs, stats.p99JitterMs, stats.maxJitterMs);
+    }
+    // the frames still ran, with the picture the jammed game left
+    if (console->cpu.jammed) {
+        fprintf(stderr, "CPU jammed at $%04X\n", console->cpu.PC);
+    }
+    int status = console->cpu.jit_mismatches() > 0 ? 2 : console->cpu.jammed ? 1 : 0;
+    delete console;
+    delete profiler;
+    return status;
+}
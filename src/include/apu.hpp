@@ -0,0 +1,164 @@
+#pragma once
+
+#include "common.hpp"
+#include "blip.hpp"
+
+class Console;
+class CPU;
+class Cartridge;
+class AudioRing;
+
+/**
+ * Everything the APU needs to carry on from where it was, plain data for
+ * save states like the other parts.  All the timers count CPU cycles.
+ */
+struct APUState {
+
+    struct Envelope {
+        bool start, loop, constant;
+        u8 period, divider, decay;
+    };
+
+    struct Pulse {
+        bool enabled;
+        u8 duty, step;
+        u16 period;
+        s32 timer;
+        u8 length;
+        Envelope envelope;     // loop doubles as the length counter halt
+        bool sweepEnabled, sweepNegate, sweepReload;
+        u8 sweepPeriod, sweepShift, sweepDivider;
+    };
+
+    struct Triangle {
+        bool enabled, control, linearReload; // control also halts the length counter
+        u8 linearPeriod, linear;
+        u8 length, step;
+        u16 period;
+        s32 timer;
+    };
+
+    struct Noise {
+        bool enabled, mode;
+        u8 length;
+        u16 period, shift;
+        s32 timer;
+        Envelope envelope;
+    };
+
+    /**
+     * delta modulation channel, plays 1 bit deltas it fetches from PRG
+     * itself, stealing CPU cycles to do so
+     */
+    struct DMC {
+        bool irqEnabled, loop;
+        u16 period;
+        s32 timer;
+        u8 output;
+        u16 sampleAddress, sampleLength;
+        u16 address, remaining;   // where the next fetch comes from, bytes left
+        u8 buffer;
+        bool bufferFull;
+        u8 shift, bits;           // output unit
+        bool silence;
+    };
+
+    Pulse pulse[2];
+    Triangle triangle;
+    Noise noise;
+    DMC dmc;
+
+    /**
+     * frame counter, quarter and half frame clocks for envelopes, sweeps
+     * and length counters, plus the frame IRQ in 4 step mode
+     */
+    bool fiveStep, irqInhibit;
+    bool frameIrq, dmcIrq;
+    u8 frameStep;
+    s64 frameStart;   // CPU cycle the current sequence started at
+
+    /**
+     * CPU cycles the APU has run, sync() brings this up to the CPU's.
+     * eventClock is where it next has to run on time because the CPU
+     * could notice (IRQ, DMC fetch), the CPU syncs before going past it.
+     */
+    s64 clock = 0;
+    s64 eventClock = 0;
+
+    //cycles the DMC has taken from the CPU that the CPU still has to spend
+    int stall;
+};
+
+class APU : public APUState {
+public:
+
+    explicit APU(Console &console);
+
+    void power();
+
+    //$4000-$4013, $4015 and $4017, sync first
+    void write(u16 addr, u8 v);
+
+    //$4015, sync first
+    u8 read_status();
+
+    /**
+     * run the APU up to the CPU's cycle count, raising or dropping the
+     * CPU's IRQ line as it goes
+     */
+    void sync();
+
+    /**
+     * Where samples go, 16 bit mono at sampleRate.  Without one the APU
+     * only keeps what the CPU can see (lengths, IRQs, DMC) running.
+     */
+    void set_output(AudioRing *ring, int sampleRate);
+
+    /**
+     * make slightly more (ratio > 1) or fewer samples per second of
+     * emulated time than the output rate, for RateControl
+     */
+    void set_rate_ratio(double ratio);
+
+    //off for frames nobody is going to hear, like set_video on the PPU
+    void set_audio(bool on) { audio = on; }
+
+    //NTSC CPU clock
+    static constexpr double CPU_HZ = 1789773.0;
+
+private:
+
+    CPU &cpu;
+    Cartridge &cartridge;
+
+    /**
+     * The sound itself isn't part of the state, like the PPU's picture.
+     * Channel levels go to the blip buffer only when they change.
+     */
+    AudioRing *output = nullptr;
+    int sampleRate = 0;
+    bool audio = true;
+    float level = 0;    // mixer output the blip buffer has been told about
+    BlipBuffer blip;
+    s16 samples[BlipBuffer::SIZE];
+
+    bool listening() const { return output != nullptr && audio; }
+    void run(s64 until);
+    void run_dmc(s64 cycles);
+    float mix() const;
+    void update_level();
+    void flush();
+    void frame_step();
+    void quarter_frame();
+    void half_frame();
+    void clock_envelope(Envelope &e);
+    void clock_sweep(Pulse &p, int channel);
+    u16 sweep_target(const Pulse &p, int channel) const;
+    void clock_dmc();
+    void dmc_fetch();
+    void predictEvent();
+
+    u8 pulse_output(const Pulse &p, int channel) const;
+    u8 triangle_output() const;
+    u8 noise_output() const;
+};
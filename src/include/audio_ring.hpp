@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include "common.hpp"
+
+/**
+ * Samples on their way from the emulation thread to the audio callback.
+ * One thread pushes and one pops, each only ever stores its own index, so
+ * neither side takes a lock or waits on the other.  The buffer is
+ * allocated once up front, pushing never allocates.
+ */
+class AudioRing {
+public:
+
+    //capacity is rounded up to a power of two
+    explicit AudioRing(size_t capacity);
+
+    AudioRing(const AudioRing &) = delete;
+    AudioRing &operator=(const AudioRing &) = delete;
+
+    ~AudioRing();
+
+    //producer side: copies as many samples as fit, returns how many
+    size_t push(const s16 *samples, size_t count);
+
+    //consumer side: takes up to count samples, returns how many
+    size_t pop(s16 *out, size_t count);
+
+    //samples waiting, exact for either side and a snapshot for anyone else
+    size_t size() const;
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    s16 *buffer;
+    size_t mask;
+
+    // free running, on their own cache lines so the two threads don't
+    // keep stealing one from each other
+    alignas(64) std::atomic<size_t> head{0}; // next write, producer owned
+    alignas(64) std::atomic<size_t> tail{0}; // next read, consumer owned
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.hpp"
+
+/**
+ * Band-limited synthesis, blip buffer style.  Instead of sampling the
+ * mixer every CPU cycle, the APU only reports the moments its output
+ * changes and by how much.  Each change is written into the buffer as a
+ * band-limited step (a windowed sinc impulse on the difference signal,
+ * picked from a table by the sub-sample phase), and reading integrates
+ * the differences back into samples.  That does the resampling from the
+ * CPU clock to the output rate in the same pass, with work proportional
+ * to the number of changes rather than the number of cycles.
+ */
+class BlipBuffer {
+public:
+
+    //impulse length in output samples, also the latency in samples
+    static const int TAPS = 16;
+
+    //samples that can be waiting to be read, read more often than this
+    static const int SIZE = 4096;
+
+    BlipBuffer();
+
+    /**
+     * clocks per second in, samples per second out, can change at any
+     * time without disturbing what is already in the buffer
+     */
+    void set_rates(double clockRate, double sampleRate);
+
+    //move time forward
+    void advance(s64 clocks) { pos += clocks * factor; }
+
+    //the output steps by delta at the current time
+    void add_delta(float delta);
+
+    //samples that no future delta can change any more
+    int available() const { return (int) (pos >> FRAC_BITS); }
+
+    /**
+     * take up to max finished samples as 16 bit, with a DC blocking high
+     * pass, returns how many
+     */
+    int read(s16 *out, int max);
+
+    void clear();
+
+private:
+    static const int FRAC_BITS = 32;
+
+    // time as output samples since buffer[0], 32.32 fixed point
+    u64 pos = 0;
+    u64 factor = 0;
+
+    float sum = 0;     // integrator, leaks a little to block DC
+    float pole = 1;
+
+    alignas(32) float buffer[SIZE + TAPS];
+};
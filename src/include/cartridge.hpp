@@ -1,22 +1,65 @@
 #pragma once
 
+#include <cstddef>
 #include "common.hpp"
+#include "mapper.hpp"
 
-namespace Cartridge {
+class Console;
+class CPU;
+class PPU;
+class APU;
+
+class Cartridge {
+public:
+
+    explicit Cartridge(Console &console);
+
+    Cartridge(const Cartridge &) = delete;
+    Cartridge &operator=(const Cartridge &) = delete;
+
+    ~Cartridge();
+
+    Mapper *mapper = nullptr;
 
 //program ROM/RAM
 //bool wr determines whether we write or not
     template<bool wr>
     u8 access(u16 addr, u8 v = 0);
 
+//PRG-ROM at $8000-$FFFF, straight from the mapper's page table
+    u8 prg_read(u16 addr) { return mapper->prg_read(addr); }
+
 //graphic ROM/RAM
     template<bool wr>
     u8 chr_access(u16 addr, u8 v = 0);
 
-//load the ROM from file into memory
-    void load(const char *fileName);
+//pattern table row at addr (low plane address) decoded into 2 bit pixels,
+//leftmost pixel in the top bits
+    u16 chr_row(u16 addr) { return mapper->chr_row(addr); }
+
+//same row mirrored, for horizontally flipped sprites
+    u16 chr_row_flipped(u16 addr) { return mapper->chr_row_flipped(addr); }
+
+//load the ROM from file into memory, false (with the reason on stderr) if
+//it can't be read or isn't a ROM we can run
+    bool load(const char *fileName);
+
+//load a ROM image already in memory.  It is borrowed, not copied, so it
+//has to outlive the cartridge, and any number of cartridges can share it.
+//False the same way, with the cartridge left as it was
+    bool load(const u8 *rom, size_t size);
 
 //return true if ROM has been loaded into memory
     bool loaded();
 
-} // namespace Cartridge
+//64 bit FNV-1a of the whole ROM image, tells recordings which ROM they are for
+    u64 rom_hash() const { return romHash; }
+
+private:
+    CPU &cpu;
+    PPU &ppu;
+    APU &apu;
+
+    u8 *image = nullptr; //the ROM file, when we read it ourselves
+    u64 romHash = 0;
+};
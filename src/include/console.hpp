@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include "common.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "apu.hpp"
+#include "cartridge.hpp"
+#include "controller.hpp"
+
+/**
+ * One whole NES.  Everything the machine needs lives in here, the parts
+ * reach each other through the console they were built with, so any
+ * number of them can run side by side.
+ */
+class Console {
+public:
+    CPU cpu;
+    PPU ppu;
+    APU apu;
+    Cartridge cartridge;
+    Controller controller;
+
+    Console();
+
+    Console(const Console &) = delete;
+    Console &operator=(const Console &) = delete;
+
+    //load a ROM and power on, false if it can't be run (the reason is on stderr)
+    bool load(const char *fileName);
+
+    //same from a ROM image in memory, which is shared rather than copied
+    bool load(const u8 *rom, size_t size);
+
+    //run until the PPU starts vblank, which is where frames end
+    void run_frame();
+
+    /**
+     * Run-ahead: run the real frame without drawing it, snapshot, run
+     * `frames` more with the same input drawing only the last one, then go
+     * back to the snapshot.  Only the real frame is heard.  The picture is
+     * `frames` frames ahead of the machine, which hides that much of the
+     * game's own input lag.
+     */
+    void run_frame_ahead(int frames);
+
+    //last finished frame, 256x240 XRGB
+    const u32 *frame() const { return ppu.frame(); }
+
+    //64 bit FNV-1a of the last finished frame, for comparing runs
+    u64 frame_hash() const;
+
+    //buttons held on port 0 or 1, read at the next strobe
+    void set_input(int port, u8 buttons) { controller.set_buttons(port, buttons); }
+
+    /**
+     * Save states.  The blob is a header, then the CPU, PPU, APU and
+     * controller state structs as they are in memory, then the mapper's RAM and
+     * registers, so saving is one memcpy per part.  It is only meant to be
+     * read back by the same build with the same ROM loaded: change
+     * STATE_VERSION whenever one of the state structs changes.
+     *
+     * Take them between frames, the picture is not part of the state.
+     */
+    static const u32 STATE_VERSION = 8;
+
+    //bytes save_state writes, fixed once a ROM is loaded
+    size_t state_size() const;
+
+    void save_state(u8 *out) const;
+
+    //false, leaving the console untouched, if the blob does not fit
+    bool load_state(const u8 *in, size_t size);
+
+private:
+    std::vector<u8> aheadState; //the real machine while run-ahead frames run
+};
@@ -5,15 +5,32 @@
 #ifndef NES_EMULATOR_CONTROLLER_H
 #define NES_EMULATOR_CONTROLLER_H
 
-namespace Controller {
+#include "common.hpp"
+
+// shift register and the buttons last pushed in, plain data for save states
+struct ControllerState {
+    u8 buttons[2] = {0, 0};
+    u8 controller1_status = 0;
+    u8 controller2_status = 0;
+    bool strobe = false;
+    int counter = 0;
+    int counter2 = 0;
+};
+
+class Controller : public ControllerState {
+public:
+
+    /**
+     * buttons held on a port, one bit each in the order the shift register
+     * reports them: A, B, select, start, up, down, left, right
+     */
+    void set_buttons(int port, u8 state);
 
     void setControllerStatus(bool setStrobe);
 
     u8 getController1();
 
     u8 getController2();
-}
+};
 
 #endif //NES_EMULATOR_CONTROLLER_H
-
-
@@ -1,11 +1,23 @@
 #pragma once
 
+#include <cassert>
+#include <cstddef>
 #include "common.hpp"
+#include "jit.hpp"
 
+class Console;
+class PPU;
+class APU;
+class Cartridge;
+class Controller;
+class Profiler;
+class TraceLog;
 
-namespace CPU {
-
-    void set_debug(bool debug = true);
+/**
+ * Everything the CPU needs to carry on from where it was.  It is plain
+ * data so a save state can copy it in one go.
+ */
+struct CPUState {
 
     /*   Processor Flags
     /    C represents Carry Flag, is used also in shift and rotate ops
@@ -20,39 +32,95 @@ namespace CPU {
     /      cleared if positive
     */
     enum Flag {
-        C, Z, I, D, V, N
+        C, I, D, V, Z, N
     };
 
-    //addressing mode
-    typedef u16 (*Mode)(void);
-
     class Flags {
 
-        bool f[6];  //represent each of 6 enum Flags
+        bool f[4];  //C, I, D and V by their enum Flags, Z and N come from nz
+
+        /*
+         * the result N and Z were last set from, so most instructions only
+         * store it and the flags are worked out when something reads them:
+         * Z if the low byte is 0, N if bit 7 or 8 is set (bit 8 for N
+         * without a result to match, as BIT and PLP can leave it)
+         */
+        u16 nz;
 
     public:
 
-        //allows for accessing flag based on indexed enum
-        bool &operator[](const int i) { return f[i]; }
+        //allows for accessing flag based on indexed enum, not Z or N, those have no bool
+        bool &operator[](Flag i) {
+            assert(i < Z);
+            return f[i];
+        }
+
+        bool zero() const { return !(nz & 0xFF); }
+
+        bool negative() const { return nz & 0x180; }
+
+        //N and Z from a result
+        void set_nz(u8 x) { nz = x; }
+
+        //N and Z on their own
+        void set_nz(bool n, bool z) { nz = n << 8 | !z; }
+
+        //where nz is, for compiled code
+        static size_t nz_offset() { return offsetof(Flags, nz); }
 
         /*get turns boolean array into value which would be found in register */
-        u8 get() {
-            return (f[C] | f[Z] << 1 | f[I] << 2 | f[D] << 3 | 1 << 5 |
-                    f[V] << 6 | f[N] << 7);
+        u8 get() const {
+            return (f[C] | zero() << 1 | f[I] << 2 | f[D] << 3 | 1 << 5 |
+                    f[V] << 6 | negative() << 7);
         }
 
         /* takes value that would be in register and sets bool array */
         void set(u8 p) {
             f[C] = NTH_BIT(p, 0);
-            f[Z] = NTH_BIT(p, 1);
             f[I] = NTH_BIT(p, 2);
             f[D] = NTH_BIT(p, 3);
             f[V] = NTH_BIT(p, 6);
-            f[N] = NTH_BIT(p, 7);
+            set_nz(NTH_BIT(p, 7), NTH_BIT(p, 1));
         }
 
     };
 
+    int opCode;
+
+    u8 A, X, Y, S; //registers, these are as follows
+    u16 PC;        // A is Accumulator: supports carrying overflow
+    Flags P;       // detection, and so on
+    // X and Y are used for addressing modes(indices)
+    // PC is program counter, S is Stack Pointer
+    // p is status register
+
+    bool irq, nmi; //irq is interrupt request
+    //nmi is non-maskable interrupt
+    bool jammed;   //ran a KIL opcode at PC, nothing more runs until reset
+    u8 ram[0x800];
+
+    s64 cycles; //CPU cycles since power on
+
+    /* the last backward branch or jump taken, for finding idle loops */
+    u16 idleTop, idleEnd;  // where it went and where it was
+    u8 idleRegs[5];        // A, X, Y, S and P when it got there
+    s8 idleKind;           // loop idleTop-idleEnd can be skipped: 1 yes, 0 no, -1 not looked at
+    s64 idleCycles;        // when it got there, -1 after an interrupt
+};
+
+class CPU : public CPUState {
+public:
+
+    explicit CPU(Console &console);
+
+    CPU(const CPU &) = delete;
+    CPU &operator=(const CPU &) = delete;
+
+    ~CPU();
+
+    //record every instruction into log from now on, null to stop
+    void set_trace(TraceLog *log) { traceLog = log; }
+
     void set_nmi(bool v = true);
 
     void set_irq(bool v = true);
@@ -60,4 +128,195 @@ namespace CPU {
     void power();
 
     void run_frame();
-}
+
+    /**
+     * Skip the iterations of idle loops (polling RAM, ROM or vblank with
+     * nothing changing) that fit before the next PPU or APU event, on by
+     * default.  Never while tracing or profiling, those want every
+     * instruction.
+     */
+    void set_idle_skip(bool on) { idleSkip = on; }
+
+    //cycles skipped that way since power on
+    u64 idle_cycles_skipped() const { return idleSkipped; }
+
+    /**
+     * Run the idioms in CPU::idioms (DEX BNE, polling a RAM flag and so
+     * on) as one handler each when they come up in PRG-ROM, on by
+     * default.  Never while tracing.
+     */
+    void set_fusion(bool on) { fusion = on; }
+
+    /**
+     * Run code from PRG-ROM as native code compiled by the Jit, once a ROM
+     * is loaded, false if this machine can't.  With check every block is
+     * run again by the interpreter from the same state and anything that
+     * comes out different is reported on stderr, the interpreter's result
+     * is the one kept.  Off while tracing or profiling.
+     */
+    bool set_jit(bool on, bool check = false);
+
+    //cycles run as compiled code, blocks compiled and blocks that didn't match the interpreter
+    u64 jit_cycles() const { return jitCycles; }
+    u64 jit_blocks() const { return jit ? jit->compiled() : 0; }
+    u64 jit_mismatches() const { return jitMismatches; }
+
+#ifdef NES_PROFILE
+    //count every instruction into profiler from now on, null to stop
+    void set_profiler(Profiler *p) { profiler = p; }
+#endif
+
+private:
+    friend struct Bench; // micro-benchmarks in bench.cpp
+
+    //addressing mode
+    typedef u16 (CPU::*Mode)(void);
+
+    //instruction handler
+    typedef void (CPU::*Op)(void);
+
+    struct OpTable;
+    static const OpTable opTable;
+
+    //instruction sequences run as one handler, see fuse()
+    enum IdiomId { DEX_BNE, DEY_BNE, LDA_CMP_BNE, INC_LDA, BIT_BPL, IDIOMS };
+    struct Idiom;
+    static const Idiom idioms[IDIOMS];
+
+    PPU &ppu;
+    APU &apu;
+    Cartridge &cartridge;
+    Controller &controller;
+
+/* tracing, not part of the machine state */
+
+    TraceLog *traceLog = nullptr;
+    bool idleSkip = true;
+    u64 idleSkipped = 0;
+    bool fusion = true;
+    Jit *jit = nullptr;
+    bool jitCheck = false;
+    u64 jitCycles = 0;
+    u64 jitMismatches = 0;
+    const u8 *code = nullptr; // rest of the instruction being run, when it is in PRG-ROM
+    static constexpr bool test = false; // flip to have the handlers print mnemonics
+
+    void tick();
+    void upd_cv(u8 x, u8 y, u16 r);
+    void upd_nz(u8 x);
+    bool cross(u16 a, u8 i);
+
+/* memory access */
+    template<bool wr>
+    u8 access(u16 addr, u8 v = 0);
+    void transferToOamWithDma(u16 addr);
+    u8 wr(u16 a, u8 v);
+    u8 rd(u16 a);
+    u16 rd16_d(u16 a, u16 b);
+    u16 rd16(u16 a);
+    u8 fetch();
+    template<Mode m> u8 operand(u16 a);
+    u8 push(u8 v);
+    u8 pop();
+
+/* addressing modes */
+    u16 imm();
+    u16 abs();
+    u16 abx();
+    u16 _abx();
+    u16 aby();
+    u16 zp();
+    u16 zpx();
+    u16 zpy();
+    u16 izx();
+    u16 _izy();
+    u16 izy();
+
+/* instructions */
+    template<Mode m> void LDA();
+    template<Mode m> void LDX();
+    template<Mode m> void LDY();
+    template<u8 CPUState::*r, Mode m> void st();
+    template<u8 CPUState::*d, u8 CPUState::*s> void tr();
+    template<Mode m> void ADC();
+    template<Mode m> void SBC();
+    template<Mode m> void DEC();
+    void DEX();
+    void DEY();
+    template<Mode m> void INC();
+    void INX();
+    void INY();
+    template<Mode m> void AND();
+    void ASL();
+    template<Mode m> void ASL();
+    template<Mode m> void BIT();
+    template<Mode m> void EOR();
+    void LSR();
+    template<Mode m> void SLO();
+    template<Mode m> void LSR();
+    template<Mode m> void ORA();
+    template<Mode m> void ROL();
+    void ROL();
+    template<Mode m> void ROR();
+    void ROR();
+    void branch(bool taken);
+    void BCC();
+    void BCS();
+    void BEQ();
+    void BMI();
+    void BNE();
+    void BPL();
+    void BVC();
+    void BVS();
+    void PHA();
+    void PLA();
+    void PHP();
+    void PLP();
+    void JMP();
+    void i_JMP();
+    void JSR();
+    void RTI();
+    void RTS();
+    void BRK();
+    template<Flag f> void cl();
+    template<Flag f> void set();
+    template<u8 CPUState::*r, Mode m> void cmp();
+    template<Mode m> void DOP();
+    void TOP();
+    template<Mode m> void ISC();
+    template<Mode m> void SRE();
+    template<Mode m> void DCP();
+    void NOP();
+    template<Mode m> void NOP();
+    void SKB();
+    void jam();
+    void undefined();
+
+/* idle loops */
+    void idle_loop(u16 end);
+    bool idle_body(u16 top, u16 end);
+    void skip_idle(s64 length);
+
+/* fused idioms */
+    bool matches(const Idiom &idiom) const;
+    void fused_next();
+    template<int i, Op first, Op... rest> void fuse();
+
+/* interpreter */
+    u8 peek(u16 addr);
+    void trace();
+#ifdef NES_PROFILE
+    Profiler *profiler = nullptr;
+    u16 opPC;     // where the instruction being run started
+    s64 opStart;  // and when
+    void profile(u16 pc, s64 start);
+    void profile_interrupt(s64 start);
+#endif
+    template<bool traced> void exec();
+    template<bool traced> void run();
+    bool run_block();
+    u32 check_block(const Jit::Block *b);
+    void reset();
+    void irq_interrupt();
+    void nmi_interrupt();
+};
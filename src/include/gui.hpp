@@ -1,6 +1,9 @@
 #pragma once
 
 #include "common.hpp"
+#include "pacer.hpp"
+
+class Console;
 
 namespace GUI {
 
@@ -20,9 +23,14 @@ namespace GUI {
         struct ControllerState controllerState;
     } controller_status;
 
-    u8 getControllerStatus();
-
-    int init();
+    struct Options {
+        int runAhead = 0;    // frames run ahead of the one shown, see Console::run_frame_ahead
+        // what frames are paced by: our clock, the display, or our clock
+        // with the sound stretched to match the sound card's
+        FramePacer::Mode sync = FramePacer::timer;
+        const char *play = nullptr;    // movie to replay before the keyboard takes over
+        const char *record = nullptr;  // where to save the movie of this session
+    };
 
-    void update_frame(u32* pixels);
+    int init(Console &console, const Options &options);
 }
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include "common.hpp"
+#include "mapper.hpp"
+
+struct CPUState;
+
+/**
+ * Recompiler for code running from PRG-ROM.  A block is the straight run
+ * of instructions from some PC up to the first branch, jump or return,
+ * translated into x86-64 that works on the CPUState directly and hands
+ * back the cycles it took, which the CPU then adds to its clocks.
+ *
+ * Blocks only touch RAM and PRG-ROM.  They end before an instruction that
+ * would reach PPU, APU or controller registers ($2000-$401F), the
+ * cartridge below $8000 or a mapper register, and instructions whose
+ * address is only known at run time leave the block when it turns out to
+ * be one of those, so the interpreter does every access with side
+ * effects.  The CPU only enters a block when its longest run fits before
+ * the next PPU or APU event, so nothing can happen while it runs that the
+ * interpreter would have seen between two instructions.
+ *
+ * A block is compiled for a PC and the PRG-ROM offset the banks map it to,
+ * and never spans two 8KB pages, so a bank switch just selects other
+ * blocks and nothing ever needs recompiling.  The interpreter stays the
+ * reference: CPU::set_jit can run every block a second time through it
+ * and compare.
+ *
+ * Only on x86-64, available() is false everywhere else.
+ */
+class Jit {
+public:
+
+    //runs the block against cpu, returns the cycles it took and LOOPED
+    typedef u32 (*Code)(CPUState *cpu);
+
+    //set in what a block returns when it left through its backward branch or jump
+    static const u32 LOOPED = 1u << 31;
+
+    struct Block {
+        Code code;        // null when the instruction at pc can't be compiled
+        u16 pc;
+        u32 romOffset;    // where pc was in PRG-ROM when it was compiled
+        int maxCycles;    // the longest it can run
+        u16 loopAt;       // the backward branch or jump it ends with, if LOOPED
+    };
+
+    static bool available();
+
+    explicit Jit(Mapper &mapper);
+
+    Jit(const Jit &) = delete;
+    Jit &operator=(const Jit &) = delete;
+
+    ~Jit();
+
+    //the block at pc ($8000-$FFFF) with the banks switched in now, compiled if it's new
+    const Block *block(u16 pc) {
+        const Block *b = recent[pc & 0x7FFF];
+        if (b && b->romOffset == mapper.prg_offset(pc)) {
+            return b;
+        }
+        return find(pc);
+    }
+
+    //blocks compiled since power on, with the ones thrown away when the code space filled
+    u64 compiled() const { return compiledCount; }
+
+private:
+    Mapper &mapper;
+
+    u8 *code;              // executable space the blocks are written to
+    size_t codeSize;
+    size_t codeUsed = 0;
+
+    std::unordered_map<u64, Block> blocks;  // by ROM offset and pc
+    const Block *recent[0x8000];             // last block looked up for each pc
+    u64 compiledCount = 0;
+
+    const Block *find(u16 pc);
+    void compile(Block &b);
+    void flush();
+};
@@ -1,20 +1,45 @@
 #pragma once
 
+#include <cstddef>
 #include <cstring>
 #include "common.hpp"
 
+class PPU;
+
 /*This class will be parent to other Mapper classes */
 
 class Mapper {
 
-    u8 *rom;             //array of ROM
-    bool chrRam = false; //we assume chrRom by default
+    u8 *chrRam = nullptr; //we assume chrRom by default
+
+    /*
+     * Decoded pattern table cache, one entry per 8 pixel row of each of the
+     * 512 tiles the PPU can see.  The two bit planes are merged into 2 bit
+     * pixels, leftmost pixel in the top bits, with a mirrored copy for
+     * flipped sprites.  A row is decoded the first time it is used after
+     * its generation goes stale, so a bank switch just bumps chrGeneration.
+     */
+    u16 chrRows[0x1000];
+    u16 chrRowsFlipped[0x1000];
+    u32 chrRowGeneration[0x1000];
+    u32 chrGeneration = 1;
+
+    static int chr_row_index(u16 addr) { return (addr >> 4) * 8 + (addr & 7); }
+
+    void decode_chr_row(int index, u16 addr);
 
 protected:
-    u32 prgMap[4]; //I think this has to do with bank switching
-    u32 chrMap[4]; //or registers in the mapper
+    /*
+     * Page tables, mappers point these at the banks currently switched in
+     * whenever their registers change so reads never have to work it out
+     */
+    const u8 *prgMap[4]; //8KB pages of PRG-ROM at $8000-$FFFF
+    const u8 *chrMap[2]; //4KB pages of CHR at $0000-$1FFF
+
+    PPU &ppu; //for mappers that switch nametable mirroring
 
-    u8 *prg, *chr, *prgRam;           //prg-ROM, chr-ROM, and prgRAM
+    const u8 *prg, *chr;              //prg-ROM and chr-ROM (or chrRam)
+    u8 *prgRam;
     u32 prgSize, chrSize, prgRamSize; //size of the above arrays
 
     template<int pageKBs>
@@ -23,18 +48,75 @@ protected:
     template<int pageKBs>
     void map_chr(int slot, int bank);
 
+    //bank configuration changed, every cached CHR row is stale
+    void invalidate_chr() { chrGeneration++; }
+
+    bool has_chr_ram() { return chrRam != nullptr; }
+
 public:
-    Mapper(u8 *rom);
+    /*
+     * rom is the iNES image.  It is only borrowed, never written, so
+     * several mappers can share one copy as long as it outlives them.
+     */
+    Mapper(const u8 *rom, PPU &ppu);
 
-    ~Mapper();
+    virtual ~Mapper();
 
     virtual u8 read(u16 addr);
 
-    virtual u8 write(u16 addr, u8 val) { return val; }
+    virtual u8 write(u16 addr, u8 val);
 
     virtual u8 chr_read(u16 addr);
 
-    virtual u8 chr_write(u16 addr, u8 v) { return v; }
+    virtual u8 chr_write(u16 addr, u8 v);
 
     virtual void signal_scanline() {}
+
+    /*
+     * Save states: the bytes save_state writes, always the same for a
+     * given cartridge.  The base mapper keeps PRG RAM and CHR RAM, mappers
+     * with registers append them and rebuild their page tables on load.
+     */
+    virtual size_t state_size() const;
+
+    virtual void save_state(u8 *out) const;
+
+    virtual void load_state(const u8 *in);
+
+    u8 prg_read(u16 addr) { return prgMap[(addr >> 13) & 3][addr & 0x1FFF]; }
+
+    //where in PRG-ROM addr ($8000-$FFFF) reads from with the current banks
+    u32 prg_offset(u16 addr) const { return prgMap[(addr >> 13) & 3] - prg + (addr & 0x1FFF); }
+
+    u32 prg_size() const { return prgSize; }
+
+    //the page table itself, for compiled code that reads PRG-ROM on its own
+    const u8 *const *prg_pages() const { return prgMap; }
+
+    u16 chr_row(u16 addr) {
+        int index = chr_row_index(addr);
+        if (chrRowGeneration[index] != chrGeneration)
+            decode_chr_row(index, addr);
+        return chrRows[index];
+    }
+
+    u16 chr_row_flipped(u16 addr) {
+        int index = chr_row_index(addr);
+        if (chrRowGeneration[index] != chrGeneration)
+            decode_chr_row(index, addr);
+        return chrRowsFlipped[index];
+    }
+
+    /*
+     * a byte of CHR RAM changed, drop the row holding it, in both slots
+     * if they have the same page switched in
+     */
+    void chr_written(u16 addr) {
+        const u8 *page = chrMap[addr >> 12];
+        for (int slot = 0; slot < 2; slot++) {
+            if (chrMap[slot] == page) {
+                chrRowGeneration[chr_row_index((slot << 12 | (addr & 0xFFF)) & ~8)] = 0;
+            }
+        }
+    }
 };
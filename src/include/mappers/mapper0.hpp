@@ -3,7 +3,7 @@
 
 class Mapper0 : public Mapper {
     public:
-        Mapper0(u8 *rom) : Mapper::Mapper(rom){
+        Mapper0(const u8 *rom, PPU &ppu) : Mapper::Mapper(rom, ppu){
 
         }
 };
\ No newline at end of file
@@ -5,9 +5,19 @@
 #include "../mapper.hpp"
 
 
-class Mapper1 : public Mapper {
+// MMC1 registers, kept apart so save states can copy them in one go
+struct Mapper1State {
+    u8 mapperControl;
+    u8 chrBank0;
+    u8 chrBank1;
+    u8 prgBank;
+    u8 shifter;
+    u8 shiftCount;
+};
+
+class Mapper1 : public Mapper, private Mapper1State {
 public:
-    Mapper1(u8 *rom) : Mapper::Mapper(rom){
+    Mapper1(const u8 *rom, PPU &ppu) : Mapper::Mapper(rom, ppu){
         mapperControl = 0 | (3 << 2);
         chrBank0 = 0;
         chrBank1 = 0;
@@ -16,26 +26,21 @@ public:
         shiftCount = 0;
         chrBanks = rom[5] ? rom[5] : 2;
         prgBanks = rom[4];
-
+        update_banks();
     }
 
-    u8 read(u16 addr) override;
-
     u8 write(u16 addr, u8 v) override;
 
-    u8 chr_read(u16 addr) override;
+    size_t state_size() const override;
+
+    void save_state(u8 *out) const override;
 
-    u8 chr_write(u16 addr, u8 v) override;
+    void load_state(const u8 *in) override;
 
 private:
-    // Registers
+    // point the page tables at the banks selected by the registers
+    void update_banks();
 
-    u8 mapperControl;
-    u8 chrBank0;
-    u8 chrBank1;
-    u8 prgBank;
-    u8 shifter;
-    u8 shiftCount;
     u8 chrBanks;
     u8 prgBanks;
 };
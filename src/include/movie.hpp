@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include "common.hpp"
+
+class Console;
+
+/**
+ * Input movie: the buttons held on both ports for every frame since
+ * power on.  The console only looks at its input between frames, so
+ * feeding the same buttons back frame by frame to the same ROM plays the
+ * same game, headless or in the window.
+ *
+ * Files are a header (with a hash of the ROM it was recorded on) and then
+ * two bytes a frame, port 0 then port 1, bits as Controller::set_buttons.
+ */
+class Movie {
+public:
+
+    //buttons for the frame about to run, while recording
+    void record(u8 port0, u8 port1) {
+        input.push_back(port0);
+        input.push_back(port1);
+    }
+
+    //forget the frames from frame on, for recording over them after rewinding
+    void truncate(size_t frame);
+
+    size_t frames() const { return input.size() / 2; }
+
+    //buttons on port in frame, none held past the end
+    u8 buttons(size_t frame, int port) const {
+        size_t at = frame * 2 + (port & 1);
+        return at < input.size() ? input[at] : 0;
+    }
+
+    //set the console's ports to what they were in frame
+    void play(Console &console, size_t frame) const;
+
+    //hash of the ROM it was recorded with, see Cartridge::rom_hash
+    u64 romHash = 0;
+
+    bool save(const char *fileName) const;
+
+    //false, with the movie left empty, if the file isn't one
+    bool load(const char *fileName);
+
+private:
+    std::vector<u8> input;
+};
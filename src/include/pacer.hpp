@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include "common.hpp"
+
+/**
+ * Keeps frames coming at a steady rate.  In timer mode it waits for each
+ * frame's deadline on the steady clock, sleeping for most of the wait and
+ * spinning through the last stretch, since sleeps wake up late by an
+ * amount that depends on the OS.  In vsync mode presenting the frame
+ * blocks for us and the pacer only keeps the statistics.  Audio mode
+ * times frames like timer mode, the difference is on the sound side: the
+ * samples are stretched to fit the frames (see RateControl) rather than
+ * dropped or padded with silence when the two clocks drift apart.
+ */
+class FramePacer {
+public:
+
+    enum Mode {
+        timer, vsync, audio
+    };
+
+    //NTSC: 1789772.7 Hz CPU clock over 29780.5 cycles per frame
+    static constexpr double NTSC_FPS = 60.0988;
+
+    explicit FramePacer(Mode mode = timer, double fps = NTSC_FPS);
+
+    /**
+     * wait until the next frame is due, call once per frame right before
+     * presenting it
+     */
+    void wait();
+
+    struct Stats {
+        int frames;
+        double meanMs;      // average time between frames
+        double p99JitterMs; // 99th percentile distance from the target period
+        double maxJitterMs;
+    };
+
+    //over the last few seconds of frames
+    Stats stats() const;
+
+    Mode mode() const { return pacing; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Mode pacing;
+    Clock::duration period;
+    Clock::time_point deadline;
+    Clock::time_point last;
+    bool started = false;
+
+    // how late sleeps have woken up recently, the spin covers this much
+    Clock::duration margin = std::chrono::microseconds(500);
+
+    std::vector<double> intervals; // ring of frame times in ms
+    size_t next = 0;
+    size_t count = 0;
+};
+
+/**
+ * Dynamic rate control.  The sound card's clock and ours never agree
+ * exactly, so a buffer between them slowly fills up or runs dry.  Once a
+ * frame this looks at how full the buffer is and returns a factor, never
+ * more than maxAdjust away from 1, to scale the output sample rate by:
+ * a little more sound per frame when the buffer is below target, a little
+ * less above it.  Half a percent is too small to hear as pitch.
+ */
+class RateControl {
+public:
+
+    explicit RateControl(size_t target, double maxAdjust = 0.005);
+
+    //samples waiting right after this frame's were queued
+    double update(size_t fill);
+
+    double ratio() const { return current; }
+
+    //buffer level the ratio is steering by, smoothed over a few frames
+    double fill() const { return smoothed; }
+
+private:
+    double target;
+    double maxAdjust;
+    double smoothed;
+    double current = 1;
+};
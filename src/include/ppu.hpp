@@ -2,24 +2,201 @@
 
 #include "common.hpp"
 
-namespace PPU {
+class Console;
+class CPU;
+class Cartridge;
+
+/**
+ * Everything the PPU needs to carry on from where it was.  It is plain
+ * data so a save state can copy it in one go, the picture itself is not
+ * part of it.
+ */
+struct PPUState {
 
     enum Mirroring {
         vertical, horizontal, singleLow, singleHigh
     };
 
+    /**
+     * Master clock in PPU dots.  The CPU moves targetClock forward as it
+     * runs and the PPU only catches up to it when sync() is called, which
+     * the CPU does before touching anything the PPU can see.
+     *
+     * eventClock is the target at which the PPU next signals the CPU
+     * (vblank NMI), the CPU must sync before running past it.
+     */
+    s64 targetClock = 0;
+    s64 eventClock = 0;
+
+    /**
+     * PPU control 0x2000
+     *
+     *  flags by bit VPHB SINN
+     *  V = NMI (non-maskable interrupt)
+     *  P = PPU master/slave
+     *  H = Sprite height
+     *  B = background tile select
+     *  S = sprite tile select
+     *  I = increment mode
+     *  NN = Nametable select
+     */
+    u8 ppuCtl;
+
+    /**
+     * PPU mask 0x2001
+     *
+     * flags by bit BGRs bMmG
+     *
+     * BRG = color emphasis
+     * s = sprite enable
+     * b = background enable
+     * M = sprite left column enable
+     * m = background left column enable
+     * G = grey scale
+     */
+    u8 ppuMask;
+
+    /**
+     * PPU Status 0x2002
+     *
+     * flags by bit VSO- ----
+     *
+     * V = vblank
+     * S = sprite 0 hit
+     * O = sprite overflow
+     */
+    u8 ppuStatus;
+
+    /**
+     * Object Attribute Memory(OAM) address 0x2003
+     *
+     * the address to read/write to OAM
+     */
+    u8 oamAddr;
+
+    /**
+     * PPU Data 0x2007
+     *
+     * ppu data read/write
+     */
+    u8 ppuData;
+
+    u8 vRam[0x800];
+    u8 palleteRam[0x20];
+
+    /**
+     * Object Attribute Memory
+     */
+    u8 OAM[0x100];
+
+    /**
+     * Secondary OAM buffer
+     */
+    u8 secondaryOamBuffer[0x40];
+
+    u8 spriteIndex;
+    u8 coordinateIndex;
+    u8 secondaryOamIndex;
+
+    u16 spriteRows[8]; // decoded pattern row per sprite, flips already applied
+    u8 counters[8];
+    u8 attributeLatches[8];
+    u8 spriteIndices[8];
+    u8 indexLatches[8]; // OAM index of each sprite being drawn, for sprite 0 hit
+
+    /**
+     * represents step we are on
+     *
+     *  261 or 260 unclear
+     */
+    int scanline;
+
+    /**
+     * Synonymous with dot, in some documentation.
+     *
+     * 341 of these per scanline
+     */
+    int cycle;
+
+    /**
+     * This is used to write 16 bit addresses through the 8-bit bus,
+     * latch being active means we are on second half
+     *
+     * Reading from ppuStatus resets the latch
+     */
+    bool addressLatch;
+
+    /**
+     * dots the PPU has actually run, sync() brings this up to targetClock
+     */
+    s64 clock = 0;
+
+    Mirroring mirroring;
+
+    /**
+     * Internal registers of PPU
+     *
+     * vRamAddr = v (current VRAM addr, 15 bit)
+     * temporaryVramAddr = t (temporary VRAM addr, 15  bit) or top left onscreen
+     * fineXScroll = x (3 bits)
+     * firstOrSecondWriteToggle = w (1 bit)
+     *
+     * Aside on 15,  when drawing background it updates the address to point
+     * to nametable.  Bits 10-11 hold base address of nametable, 12-14 are Y offset
+     * of scanline.
+     */
+    u16 vRamAddr, temporaryVramAddr;
+    u8 fineXScroll;
+
+    /**
+     * This internal PPU register contains the pattern table data, as 2 bit
+     * pixels decoded by the cartridge's CHR cache
+     *
+     * The upper 16 bits are used,  while the lower 16 bits are loaded,  followed
+     * by a shift
+     */
+    u32 bgPatternShifter;
+    /**
+     * The contain pallete information for lower 8 bits of pattern table data
+     */
+    u16 bgAttributeLow, bgAttributeHigh;
+
+    /**
+     * latches which load into registers
+     */
+    u8 nametable, attributeByte;
+    u16 bgRow;
+
+    /**
+     * This is what I use to keep track of last address used
+     */
+    u16 renderingAddr;
+
+    /**
+     * vblank was reached since the CPU last finished a frame
+     */
+    bool frameDone = false;
+};
+
+class PPU : public PPUState {
+public:
+
+    explicit PPU(Console &console);
+
     void set_mirroring(Mirroring newMirroring);
 
     template<bool wr>
     u8 accessRegisters(u16 addr, u8 val = 0);
 
-    template<bool wr>
-    u8 access(u16 addr, u8 v = 0);
-
     void power();
 
     void doStep();
 
+    /**
+     * run the PPU forward until it reaches targetClock
+     */
+    void sync();
+
     /**
      * transfer 256 byte data directly to OAM
      */
@@ -29,4 +206,75 @@ namespace PPU {
 
     int getScanline();
 
-}
+    /**
+     * where the PPU would be if it had caught up to targetClock, without
+     * running it there
+     */
+    void target_position(int &line, int &dot) const;
+
+    /**
+     * the last finished frame, 256x240 XRGB.  It stays put while the next
+     * one is drawn into the other buffer.
+     */
+    const u32 *frame() const { return front; }
+
+    /**
+     * true once for every frame, the first time it is asked after vblank
+     * started
+     */
+    bool frame_done();
+
+    /**
+     * With video off the PPU keeps running but draws nothing and leaves
+     * the last frame up, for frames nobody is going to see.
+     */
+    void set_video(bool on) { video = on; }
+
+    void drawPatterns();
+
+private:
+    friend struct Bench; // micro-benchmarks in bench.cpp
+
+    CPU &cpu;
+    Cartridge &cartridge;
+
+    /**
+     * pixels is the frame being drawn, front the last finished one,
+     * they trade places at the end of every frame
+     */
+    u32 buffers[2][256*240];
+    u32 *pixels = buffers[0];
+    u32 *front = buffers[1];
+
+    bool video = true;
+
+    bool rendering();
+    u16 get_nametable_mirroring(u16 addr);
+    u8 ppu_read(u16 addr);
+    u8 ppu_write(u16 addr, u8 value);
+    void drawNametable();
+    void drawAttrTable();
+    void printPatternTable(int addr);
+    void loadShifters();
+    u16 getNametableByteAddr();
+    u8 getSpriteSize();
+    u16 getAttributeByteAddr();
+    u16 getSpriteTableLowAddr(u8 tileIndex, u8 yPos);
+    u16 getPatternTableLowAddr();
+    void shiftShifters();
+    u8 paletteColor(u8 index);
+    u8 spritePixel(u16 val);
+    u16 backgroundPixel();
+    void writePixel();
+    void evaluateSprites();
+    void shiftHorizontal();
+    void shiftVertical();
+    bool isVisibleScanline();
+    bool isVisibleCycle();
+    bool isVerticleBlankingScanline();
+    void setInterruptToCpuIfNeeded();
+    void scan_line();
+    void fetchTile();
+    void renderLine();
+    void predictEvent();
+};
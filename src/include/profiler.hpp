@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+#include "common.hpp"
+
+class Mapper;
+
+/**
+ * Where the guest spends its time.  The CPU reports every instruction it
+ * runs with the cycles it took, counted in a flat table with one entry
+ * per location: $0000-$7FFF as they are, PRG-ROM by its offset in the ROM
+ * so code in different banks at the same address is kept apart.  JSR,
+ * BRK and interrupts push a frame on a shadow call stack, RTS and RTI pop
+ * it, which gives cycles per call stack for flame graphs.  The idioms
+ * the CPU fuses are counted too, with how often they could be.
+ *
+ * Only built into the CPU with NES_PROFILE defined (make PROFILE=1),
+ * without it the interpreter has no trace of it.
+ */
+class Profiler {
+public:
+
+    //prgSize of the cartridge that is going to be profiled
+    explicit Profiler(u32 prgSize);
+
+    //table index for the code at addr with the banks mapper has in now
+    static u32 location(u16 addr, const Mapper &mapper);
+
+    void instruction(u32 location, u16 addr, int cycles) {
+        Entry &e = entries[location];
+        e.instructions++;
+        e.cycles += cycles;
+        e.addr = addr;
+        nodes[current].cycles += cycles;
+    }
+
+    //entered a subroutine or handler, cycles spent getting there
+    void call(u32 location, u16 addr, int cycles = 0);
+
+    void ret();
+
+    //idiom came up in PRG-ROM, fused or, too close to an event, not
+    void fusion(int idiom, const char *name, bool fused) {
+        if (idiom >= (int) fusions.size()) {
+            fusions.resize(idiom + 1);
+        }
+        Fusion &f = fusions[idiom];
+        f.name = name;
+        f.seen++;
+        f.fused += fused;
+    }
+
+    //the top locations by cycles, with their share of the total, then the idioms
+    void write_report(FILE *out, int top = 50) const;
+
+    //one line per call stack: frames separated by ';', then its cycles
+    void write_folded(FILE *out) const;
+
+private:
+
+    struct Entry {
+        u64 instructions = 0;
+        u64 cycles = 0;
+        u16 addr = 0;      // CPU address it was last run from
+    };
+
+    //call stack tree, each node holds the cycles spent in it but not below
+    struct Node {
+        u32 parent;
+        u32 location;
+        u16 addr;
+        u64 cycles;
+    };
+
+    struct Fusion {
+        const char *name = nullptr;
+        u64 seen = 0;
+        u64 fused = 0;
+    };
+
+    // games push their own return addresses and RTS through jump tables,
+    // so the shadow stack can only ever be a guess; cap it
+    static const int MAX_DEPTH = 128;
+
+    std::vector<Entry> entries;
+    std::vector<Node> nodes;
+    std::unordered_map<u64, u32> children; // parent << 32 | location
+    u32 current = 0;
+    int depth = 0;
+    int overflow = 0;  // calls past MAX_DEPTH
+    std::vector<Fusion> fusions;  // by the CPU's idiom number
+
+    static void name(char *out, size_t size, u32 location, u16 addr);
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "common.hpp"
+
+class Console;
+
+/**
+ * The last few seconds of save states, one per frame.  Every
+ * keyframeInterval frames a full state is kept, the frames in between
+ * only keep the bytes that differ from it (XOR against the keyframe, with
+ * the runs of zeros left out), so memory stays bounded by the ring size.
+ */
+class Rewind {
+public:
+
+    explicit Rewind(int frames = 600, int keyframeInterval = 60);
+
+    /**
+     * record the console, call after every frame it runs
+     */
+    void push(const Console &console);
+
+    /**
+     * Go back one frame: restore the state from two frames ago and run
+     * the next frame again with the input it had, so the console ends up
+     * exactly where it was a frame ago with that frame's picture drawn.
+     * Returns false, leaving the console alone, when there is nothing to
+     * go back to.
+     */
+    bool step_back(Console &console);
+
+    void clear();
+
+    //states held right now
+    int size() const { return count; }
+
+private:
+
+    struct Entry {
+        u64 keyframe;          // sequence number of the keyframe it is relative to
+        bool full;             // data is a whole state rather than a delta
+        u8 input[2];           // buttons the frame ending here ran with
+        std::vector<u8> data;
+    };
+
+    std::vector<Entry> ring;
+    int keyframeInterval;
+    int count = 0;
+    u64 next = 0;              // sequence number the next push gets
+    u64 lastKeyframe = 0;
+    size_t stateSize = 0;
+
+    std::vector<u8> state;     // scratch for save_state and decoding
+
+    Entry &entry(u64 sequence) { return ring[sequence % ring.size()]; }
+
+    void drop_oldest();
+    void encode(Entry &e, const u8 *key);
+    void decode(const Entry &e);
+};
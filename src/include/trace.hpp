@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include "common.hpp"
+
+/**
+ * One executed instruction, as the CPU was right before running it.
+ * Fixed size and plain, so traces are written and read as raw arrays.
+ */
+struct TraceRecord {
+    u64 cycles;       // CPU cycles since power on
+    u16 pc;
+    u8 bytes[3];      // opcode and the two bytes after it
+    u8 a, x, y, p, s;
+    u16 dot;          // PPU position
+    s16 scanline;
+};
+
+static_assert(sizeof(TraceRecord) == 24, "trace files are arrays of 24 byte records");
+
+/**
+ * Instruction trace kept in a ring of fixed size records, so tracing
+ * costs a copy per instruction instead of a printf.  With a file the
+ * ring is written out every time it fills and the trace can be as long
+ * as the disk allows, without one it keeps the most recent instructions
+ * and save() writes those.
+ *
+ * Files are a header followed by the records oldest first, nes_tracedump
+ * turns them into nestest.log style text.
+ */
+class TraceLog {
+public:
+
+    //capacity in records
+    explicit TraceLog(size_t capacity = 1 << 16, FILE *stream = nullptr);
+
+    TraceLog(const TraceLog &) = delete;
+    TraceLog &operator=(const TraceLog &) = delete;
+
+    ~TraceLog();
+
+    //space for the next record, filled in by the caller
+    TraceRecord &next() {
+        if (count == capacity && stream) {
+            flush();
+        }
+        TraceRecord &r = records[head];
+        if (++head == capacity) {
+            head = 0;
+        }
+        if (count < capacity) {
+            count++;
+        }
+        total++;
+        return r;
+    }
+
+    //with a stream: write out what is buffered
+    void flush();
+
+    //without one: header and the records held, oldest first
+    bool save(FILE *out) const;
+
+    u64 recorded() const { return total; }
+
+    //records held that haven't been written out, and the i-th of them, oldest first
+    size_t held() const { return count; }
+    const TraceRecord &held(size_t i) const {
+        size_t at = head + capacity - count + i;
+        return records[at < capacity ? at : at - capacity];
+    }
+
+    //forget the records held, for readers that have looked at them already
+    void clear() { count = 0; }
+
+    /* reading trace files back */
+
+    static bool read_header(FILE *in);
+
+    //nestest.log style line for r, without the trailing newline
+    static void format(const TraceRecord &r, char *out, size_t size);
+
+private:
+    TraceRecord *records;
+    size_t capacity;
+    size_t head = 0;   // next slot to fill
+    size_t count = 0;  // slots holding records not written out yet
+    u64 total = 0;
+    FILE *stream;
+
+    static void write_header(FILE *out);
+};
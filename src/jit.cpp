@@ -0,0 +1,913 @@
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#include "include/jit.hpp"
+#include "include/cpu.hpp"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+namespace {
+
+    /* where things are in the CPUState, which the blocks keep in rbx */
+    const int REG_A = offsetof(CPUState, A);
+    const int REG_X = offsetof(CPUState, X);
+    const int REG_Y = offsetof(CPUState, Y);
+    const int REG_S = offsetof(CPUState, S);
+    const int REG_PC = offsetof(CPUState, PC);
+    const int OPCODE = offsetof(CPUState, opCode);
+    const int RAM = offsetof(CPUState, ram);
+    const int STACK = RAM + 0x100;
+
+    //C, I, D and V, a bool each at their Flag index
+    int flag(CPUState::Flag f) {
+        assert(f < CPUState::Z);
+        return offsetof(CPUState, P) + f;
+    }
+
+    //the result N and Z are worked out from, see CPUState::Flags
+    const int NZ = offsetof(CPUState, P) + CPUState::Flags::nz_offset();
+
+    //bit of each flag in the P byte, by Flag
+    const int flagBits[6] = {0, 2, 3, 6, 1, 7};
+
+    enum Reg { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
+    enum Cond { BELOW = 2, ABOVE_EQUAL, ZERO, NOT_ZERO, BELOW_EQUAL, ABOVE };
+
+    // the /digit of each with an immediate, (op << 3) | 1 is the register form
+    enum Alu { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+
+    /**
+     * Just enough of an x86-64 assembler for the blocks.  Memory operands
+     * are [rbx + disp32] or [rbx + index + disp32], and bytes only go
+     * through al, cl and dl.  r12 counts the cycles that depend on page
+     * crosses.
+     */
+    class Asm {
+    public:
+        explicit Asm(u8 *start) : start(start), at(start) {}
+
+        size_t size() const { return at - start; }
+
+        void b(u8 v) { *at++ = v; }
+
+        void d(u32 v) {
+            memcpy(at, &v, 4);
+            at += 4;
+        }
+
+        void load(Reg r, int disp) { b(0x0F); b(0xB6); mem(r, disp); }                  // movzx r, byte [rbx + disp]
+        void load(Reg r, Reg index, int disp) { b(0x0F); b(0xB6); mem(r, index, disp); }
+        void load16(Reg r, int disp) { b(0x0F); b(0xB7); mem(r, disp); }                // movzx r, word [rbx + disp]
+        void store(Reg r, int disp) { b(0x88); mem(r, disp); }                          // mov [rbx + disp], r8
+        void store(Reg r, Reg index, int disp) { b(0x88); mem(r, index, disp); }
+        void store_imm(int disp, u8 v) { b(0xC6); mem(0, disp); b(v); }
+        void store_imm(Reg index, int disp, u8 v) { b(0xC6); mem(0, index, disp); b(v); }
+        void store16(Reg r, int disp) { b(0x66); b(0x89); mem(r, disp); }
+        void store16_imm(int disp, u16 v) { b(0x66); b(0xC7); mem(0, disp); b(v); b(v >> 8); }
+        void store32_imm(int disp, u32 v) { b(0xC7); mem(0, disp); d(v); }
+        void inc(int disp) { b(0xFE); mem(0, disp); }                                   // byte [rbx + disp]
+        void dec(int disp) { b(0xFE); mem(1, disp); }
+        void cmp_imm(int disp, u8 v) { b(0x80); mem(7, disp); b(v); }
+        void set(Cond c, int disp) { b(0x0F); b(0x90 | c); mem(0, disp); }
+        void set(Cond c, Reg r) { b(0x0F); b(0x90 | c); b(0xC0 | r); }                  // setcc r8
+
+        void mov(Reg dst, Reg src) { b(0x89); b(0xC0 | src << 3 | dst); }
+        void mov8(Reg dst, Reg src) { b(0x0F); b(0xB6); b(0xC0 | dst << 3 | src); }    // movzx dst, src8
+        void mov(Reg r, u32 v) { b(0xB8 | r); d(v); }
+        void op(Alu o, Reg dst, Reg src) { b(o << 3 | 1); b(0xC0 | src << 3 | dst); }
+        void op(Alu o, Reg r, u32 v) { b(0x81); b(0xC0 | o << 3 | r); d(v); }
+        void test(Reg a, Reg b_) { b(0x85); b(0xC0 | b_ << 3 | a); }
+        void test(Reg r, u32 v) { b(0xF7); b(0xC0 | r); d(v); }
+        void shl(Reg r, u8 n) { b(0xC1); b(0xE0 | r); b(n); }
+        void shr(Reg r, u8 n) { b(0xC1); b(0xE8 | r); b(n); }
+        void not_(Reg r) { b(0xF7); b(0xD0 | r); }
+
+        // PRG-ROM byte through the page table: from the page at *page, or at ecx
+        void rom_read(const u8 *const *page, u16 offset) {
+            b(0x48); b(0xBE); pointer(page);                // mov rsi, page
+            b(0x48); b(0x8B); b(0x36);                      // mov rsi, [rsi]
+            b(0x0F); b(0xB6); b(0x96); d(offset);           // movzx edx, byte [rsi + offset]
+        }
+
+        void rom_read(const u8 *const *pages) {
+            mov(EAX, ECX);
+            shr(EAX, 13);
+            op(AND, EAX, 3);
+            b(0x48); b(0xBE); pointer(pages);               // mov rsi, pages
+            b(0x48); b(0x8B); b(0x34); b(0xC6);             // mov rsi, [rsi + rax * 8]
+            mov(EAX, ECX);
+            op(AND, EAX, 0x1FFF);
+            b(0x0F); b(0xB6); b(0x14); b(0x06);             // movzx edx, byte [rsi + rax]
+        }
+
+        void add_cycle() { b(0x41); b(0x83); b(0xC4); b(1); }  // add r12d, 1
+
+        void prologue() {
+            b(0x53);                   // push rbx
+            b(0x41); b(0x54);          // push r12
+            b(0x48); b(0x89); b(0xFB); // mov rbx, rdi
+            b(0x45); b(0x31); b(0xE4); // xor r12d, r12d
+        }
+
+        //return eax plus the cycles counted in r12
+        void epilogue() {
+            b(0x44); b(0x01); b(0xE0); // add eax, r12d
+            b(0x41); b(0x5C);          // pop r12
+            b(0x5B);                   // pop rbx
+            b(0xC3);
+        }
+
+        //jumps return where their rel32 ends, for bind
+        size_t jump(Cond c) {
+            b(0x0F); b(0x80 | c); d(0);
+            return size();
+        }
+
+        size_t jump() {
+            b(0xE9); d(0);
+            return size();
+        }
+
+        void bind(size_t jump) {
+            u32 rel = size() - jump;
+            memcpy(start + jump - 4, &rel, 4);
+        }
+
+    private:
+        u8 *start, *at;
+
+        void mem(int reg, int disp) { b(0x83 | reg << 3); d(disp); }
+        void mem(int reg, Reg index, int disp) { b(0x84 | reg << 3); b(index << 3 | EBX); d(disp); }
+
+        void pointer(const void *p) {
+            u64 v = (u64) p;
+            memcpy(at, &v, 8);
+            at += 8;
+        }
+    };
+
+    /* addressing modes as the interpreter's handlers count them */
+    enum Mode {
+        IMP, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IZX, IZY,
+        ABX_W, ABY_W, IZY_N, IZY_W  // _abx and the STA variants that always take the extra cycle, _izy
+    };
+
+    const int modeCycles[] = {0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 3, 3, 4};
+    const int modeLength[] = {1, 2, 2, 2, 2, 3, 3, 3, 2, 2, 3, 3, 2, 2};
+
+    enum Kind {
+        NONE,
+        LDA, LDX, LDY, STA, STX, STY,
+        ADC, SBC, ORA, AND_, EOR, CMP_, CPX, CPY, BIT,
+        INC, DEC, ASL, LSR, ROR,        // memory
+        ASL_A, LSR_A, ROR_A, ROL_A,
+        INX, INY, DEX, DEY,
+        TAX, TAY, TXA, TYA, TSX, TXS,
+        CLC, SEC, CLI, SEI, CLD, SED, CLV, NOP,
+        PHA, PHP, PLA, PLP,
+        BRANCH, JMP, JSR, RTS
+    };
+
+    enum Access { READ, WRITE, MODIFY };
+
+    /**
+     * The opcodes blocks can hold, with the modes the interpreter's table
+     * gives them.  Everything else (BRK, RTI, indirect JMP, ROL of memory,
+     * the unofficial ones) ends a block and is left to the interpreter.
+     */
+    struct Table {
+        struct Entry {
+            u8 kind, mode;
+        } e[256];
+
+        void set(u8 op, Kind k, Mode m) { e[op] = {(u8) k, (u8) m}; }
+
+        void group(Kind k, const u8 (&ops)[8]) {
+            const Mode modes[8] = {IMM, ZP, ZPX, ABS, ABX, ABY, IZX, IZY};
+            for (int i = 0; i < 8; i++) {
+                set(ops[i], k, modes[i]);
+            }
+        }
+
+        Table() {
+            memset(e, 0, sizeof(e));
+            group(LDA, {0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA1, 0xB1});
+            group(ADC, {0x69, 0x65, 0x75, 0x6D, 0x7D, 0x79, 0x61, 0x71});
+            group(SBC, {0xE9, 0xE5, 0xF5, 0xED, 0xFD, 0xF9, 0xE1, 0xF1});
+            group(AND_, {0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31});
+            group(ORA, {0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11});
+            group(EOR, {0x49, 0x45, 0x55, 0x4D, 0x5D, 0x59, 0x41, 0x51});
+            group(CMP_, {0xC9, 0xC5, 0xD5, 0xCD, 0xDD, 0xD9, 0xC1, 0xD1});
+            set(0x31, AND_, IZY_N);
+            set(0x11, ORA, IZY_N);
+
+            set(0xA2, LDX, IMM); set(0xA6, LDX, ZP); set(0xB6, LDX, ZPY); set(0xAE, LDX, ABS); set(0xBE, LDX, ABY);
+            set(0xA0, LDY, IMM); set(0xA4, LDY, ZP); set(0xB4, LDY, ZPX); set(0xAC, LDY, ABS); set(0xBC, LDY, ABX);
+            set(0xE0, CPX, IMM); set(0xE4, CPX, ZP); set(0xEC, CPX, ABS);
+            set(0xC0, CPY, IMM); set(0xC4, CPY, ZP); set(0xCC, CPY, ABS);
+            set(0x24, BIT, ZP); set(0x2C, BIT, ABS);
+
+            set(0x85, STA, ZP); set(0x95, STA, ZPX); set(0x8D, STA, ABS); set(0x9D, STA, ABX_W);
+            set(0x99, STA, ABY_W); set(0x81, STA, IZX); set(0x91, STA, IZY_W);
+            set(0x86, STX, ZP); set(0x96, STX, ZPY); set(0x8E, STX, ABS);
+            set(0x84, STY, ZP); set(0x94, STY, ZPX); set(0x8C, STY, ABS);
+
+            set(0xE6, INC, ZP); set(0xF6, INC, ZPX); set(0xEE, INC, ABS); set(0xFE, INC, ABX_W);
+            set(0xC6, DEC, ZP); set(0xD6, DEC, ZPX); set(0xCE, DEC, ABS); set(0xDE, DEC, ABX_W);
+            set(0x06, ASL, ZP); set(0x16, ASL, ZPX); set(0x0E, ASL, ABS); set(0x1E, ASL, ABX_W);
+            set(0x46, LSR, ZP); set(0x56, LSR, ZPX); set(0x4E, LSR, ABS); set(0x5E, LSR, ABX_W);
+            set(0x66, ROR, ZP); set(0x76, ROR, ZPX); set(0x6E, ROR, ABS); set(0x7E, ROR, ABX_W);
+            set(0x0A, ASL_A, IMP); set(0x4A, LSR_A, IMP); set(0x6A, ROR_A, IMP); set(0x2A, ROL_A, IMP);
+
+            set(0xE8, INX, IMP); set(0xC8, INY, IMP); set(0xCA, DEX, IMP); set(0x88, DEY, IMP);
+            set(0xAA, TAX, IMP); set(0xA8, TAY, IMP); set(0x8A, TXA, IMP); set(0x98, TYA, IMP);
+            set(0xBA, TSX, IMP); set(0x9A, TXS, IMP);
+            set(0x18, CLC, IMP); set(0x38, SEC, IMP); set(0x58, CLI, IMP); set(0x78, SEI, IMP);
+            set(0xD8, CLD, IMP); set(0xF8, SED, IMP); set(0xB8, CLV, IMP);
+            for (u8 op : {0xEA, 0x1A, 0x3A, 0x5A, 0x7A, 0xDA, 0xFA}) {
+                set(op, NOP, IMP);
+            }
+            set(0x48, PHA, IMP); set(0x08, PHP, IMP); set(0x68, PLA, IMP); set(0x28, PLP, IMP);
+
+            for (u8 op : {0x10, 0x30, 0x50, 0x70, 0x90, 0xB0, 0xD0, 0xF0}) {
+                set(op, BRANCH, IMM);
+            }
+            set(0x4C, JMP, ABS); set(0x20, JSR, ABS); set(0x60, RTS, IMP);
+        }
+    };
+
+    const Table table;
+
+    const int MAX_INSTRUCTIONS = 32;
+
+    //the most code a block can take, compiling needs this much space free
+    const size_t BLOCK_SPACE = 16 * 1024;
+
+    class Compiler {
+    public:
+        Compiler(u8 *out, Mapper &mapper) : a(out), mapper(mapper) {}
+
+        size_t size() const { return a.size(); }
+
+        //false if the instruction at start can't be compiled
+        bool translate(Jit::Block &block);
+
+    private:
+        struct Exit {
+            size_t jump;
+            u16 pc;
+            int cycles;
+            int opCode;
+            bool looped;
+        };
+
+        Asm a;
+        Mapper &mapper;
+        Exit exits[2 * MAX_INSTRUCTIONS];
+        int exitCount = 0;
+
+        /* the instruction being translated */
+        u16 at;
+        int before;     // cycles before it
+        int lastOp;     // opcode before it, -1 if it is the first
+
+        enum Result { REFUSED, NEXT, END_AFTER, ENDED };
+
+        Result instruction(u8 op, u8 lo, u8 hi, int &cycles, int &maxCycles, u16 &loopAt);
+
+        bool operand(Mode m, Access access, u8 lo, u8 hi);
+        bool fixed(u16 addr, Access access);
+        void dynamic_check(Access access);
+        void dynamic_read();
+
+        //N and Z from the low byte of r
+        void nz(Reg r) {
+            a.mov8(ESI, r);
+            a.store16(ESI, NZ);
+        }
+
+        void side_exit(Cond c) { exits[exitCount++] = {a.jump(c), at, before, lastOp, false}; }
+
+        void exit(u16 pc, int cycles, int opCode, bool looped = false) {
+            a.store16_imm(REG_PC, pc);
+            exit_here(cycles, opCode, looped);
+        }
+
+        void exit_here(int cycles, int opCode, bool looped) {
+            if (opCode >= 0) {
+                a.store32_imm(OPCODE, opCode);
+            }
+            a.mov(EAX, cycles | (looped ? Jit::LOOPED : 0));
+            a.epilogue();
+        }
+
+        void push(Reg r) {
+            a.load(ECX, REG_S);
+            a.store(r, ECX, STACK);
+            a.dec(REG_S);
+        }
+
+        void push_imm(u8 v) {
+            a.load(ECX, REG_S);
+            a.store_imm(ECX, STACK, v);
+            a.dec(REG_S);
+        }
+
+        void pop(Reg r) {
+            a.inc(REG_S);
+            a.load(ECX, REG_S);
+            a.load(r, ECX, STACK);
+        }
+
+        //ASL, LSR, ROR and ROL of eax, as the interpreter does them
+        void shift(Kind k);
+    };
+
+    bool Compiler::translate(Jit::Block &block) {
+        a.prologue();
+        u16 pc = block.pc;
+        int cycles = 0, maxCycles = 0;
+        lastOp = -1;
+        block.loopAt = 0;
+        for (int n = 0;; n++) {
+            u8 op = mapper.prg_read(pc);
+            const Table::Entry &e = table.e[op];
+            int length = modeLength[e.mode];
+            // the whole block comes from one 8KB page, so it can't change under a bank switch
+            bool fits = e.kind != NONE && pc + length - 1 <= 0xFFFF && (pc + length - 1) >> 13 == block.pc >> 13;
+            Result result = REFUSED;
+            if (fits && n < MAX_INSTRUCTIONS) {
+                at = pc;
+                before = cycles;
+                u8 lo = length > 1 ? mapper.prg_read(pc + 1) : 0;
+                u8 hi = length > 2 ? mapper.prg_read(pc + 2) : 0;
+                result = instruction(op, lo, hi, cycles, maxCycles, block.loopAt);
+            }
+            if (result == REFUSED && n == 0) {
+                return false;
+            }
+            if (result == REFUSED) {
+                exit(pc, cycles, lastOp);
+                break;
+            }
+            pc += length;
+            lastOp = op;
+            if (result == END_AFTER) {
+                exit(pc, cycles, op);
+                break;
+            }
+            if (result == ENDED) {
+                break;
+            }
+        }
+        for (int i = 0; i < exitCount; i++) {
+            a.bind(exits[i].jump);
+            exit(exits[i].pc, exits[i].cycles, exits[i].opCode, exits[i].looped);
+        }
+        block.maxCycles = maxCycles;
+        return true;
+    }
+
+    /**
+     * the operand of the instruction at `at`: with READ its value in edx,
+     * otherwise its RAM index in ecx.  False, with nothing emitted, if the
+     * address is known now and is not RAM (or PRG-ROM to read)
+     */
+    bool Compiler::operand(Mode m, Access access, u8 lo, u8 hi) {
+        switch (m) {
+            case IMM:
+                a.mov(EDX, lo);
+                return true;
+            case ZP:
+                return fixed(lo, access);
+            case ABS:
+                return fixed(lo | hi << 8, access);
+            case ZPX:
+            case ZPY:
+                a.load(ECX, m == ZPX ? REG_X : REG_Y);
+                a.op(ADD, ECX, lo);
+                a.op(AND, ECX, 0xFF);
+                if (access == READ) {
+                    a.load(EDX, ECX, RAM);
+                }
+                return true;
+            case ABX:
+            case ABY:
+            case ABX_W:
+            case ABY_W:
+                a.load(EDX, m == ABX || m == ABX_W ? REG_X : REG_Y);
+                a.mov(ECX, EDX);
+                a.op(ADD, ECX, lo | hi << 8);
+                a.op(AND, ECX, 0xFFFF);
+                dynamic_check(access);
+                if ((m == ABX || m == ABY) && lo != 0) {
+                    // a page cross, lo + index carries
+                    a.op(CMP, EDX, 0xFF - lo);
+                    size_t same = a.jump(BELOW_EQUAL);
+                    a.add_cycle();
+                    a.bind(same);
+                }
+                break;
+            case IZX:
+                a.load(EDX, REG_X);
+                a.op(ADD, EDX, lo);
+                a.op(AND, EDX, 0xFF);
+                a.load(ECX, EDX, RAM);
+                a.op(ADD, EDX, 1);
+                a.op(AND, EDX, 0xFF);
+                a.load(EAX, EDX, RAM);
+                a.shl(EAX, 8);
+                a.op(OR, ECX, EAX);
+                dynamic_check(access);
+                break;
+            case IZY:
+            case IZY_N:
+            case IZY_W:
+                a.load(ESI, RAM + lo);
+                a.load(EAX, RAM + ((lo + 1) & 0xFF));
+                a.shl(EAX, 8);
+                a.op(OR, ESI, EAX);
+                a.load(EDX, REG_Y);
+                a.mov(ECX, ESI);
+                a.op(ADD, ECX, EDX);
+                a.op(AND, ECX, 0xFFFF);
+                dynamic_check(access);
+                if (m == IZY) {
+                    a.mov(EAX, ESI);
+                    a.op(XOR, EAX, ECX);
+                    a.test(EAX, 0xFF00);
+                    size_t same = a.jump(ZERO);
+                    a.add_cycle();
+                    a.bind(same);
+                }
+                break;
+            default:
+                return false;
+        }
+        if (access == READ) {
+            dynamic_read();
+        } else {
+            a.op(AND, ECX, 0x7FF);
+        }
+        return true;
+    }
+
+    bool Compiler::fixed(u16 addr, Access access) {
+        if (addr < 0x2000) {
+            if (access == READ) {
+                a.load(EDX, RAM + (addr & 0x7FF));
+            } else {
+                a.mov(ECX, addr & 0x7FF);
+            }
+            return true;
+        }
+        if (addr >= 0x8000 && access == READ) {
+            a.rom_read(mapper.prg_pages() + ((addr >> 13) & 3), addr & 0x1FFF);
+            return true;
+        }
+        return false;
+    }
+
+    //leave before the instruction if the address in ecx isn't RAM, or PRG-ROM to read
+    void Compiler::dynamic_check(Access access) {
+        if (access == READ) {
+            a.mov(EAX, ECX);
+            a.op(SUB, EAX, 0x2000);
+            a.op(CMP, EAX, 0x6000);
+            side_exit(BELOW);
+        } else {
+            a.op(CMP, ECX, 0x2000);
+            side_exit(ABOVE_EQUAL);
+        }
+    }
+
+    void Compiler::dynamic_read() {
+        a.op(CMP, ECX, 0x2000);
+        size_t rom = a.jump(ABOVE_EQUAL);
+        a.mov(EAX, ECX);
+        a.op(AND, EAX, 0x7FF);
+        a.load(EDX, EAX, RAM);
+        size_t done = a.jump();
+        a.bind(rom);
+        a.rom_read(mapper.prg_pages());
+        a.bind(done);
+    }
+
+    void Compiler::shift(Kind k) {
+        switch (k) {
+            case ASL:
+            case ASL_A:
+                a.shl(EAX, 1);
+                a.op(CMP, EAX, 0xFF);
+                a.set(ABOVE, flag(CPUState::C));
+                break;
+            case LSR:
+            case LSR_A:
+                a.test(EAX, 1);
+                a.set(NOT_ZERO, flag(CPUState::C));
+                a.shr(EAX, 1);
+                break;
+            case ROR:
+            case ROR_A:
+                a.load(EDX, flag(CPUState::C));
+                a.test(EAX, 1);
+                a.set(NOT_ZERO, flag(CPUState::C));
+                a.shr(EAX, 1);
+                a.shl(EDX, 7);
+                a.op(OR, EAX, EDX);
+                break;
+            default: // ROL_A
+                a.load(EDX, flag(CPUState::C));
+                a.test(EAX, 0x80);
+                a.set(NOT_ZERO, flag(CPUState::C));
+                a.shl(EAX, 1);
+                a.op(OR, EAX, EDX);
+                break;
+        }
+    }
+
+    Compiler::Result Compiler::instruction(u8 op, u8 lo, u8 hi, int &cycles, int &maxCycles, u16 &loopAt) {
+        Kind k = (Kind) table.e[op].kind;
+        Mode m = (Mode) table.e[op].mode;
+        // opcode fetch and addressing, then what the instruction itself takes
+        int base = 1 + modeCycles[m];
+        bool crosses = m == ABX || m == ABY || m == IZY;
+
+        switch (k) {
+            case LDA:
+            case LDX:
+            case LDY: {
+                if (!operand(m, READ, lo, hi)) {
+                    return REFUSED;
+                }
+                a.store(EDX, k == LDA ? REG_A : k == LDX ? REG_X : REG_Y);
+                nz(EDX);
+                base += 1;
+                break;
+            }
+            case STA:
+            case STX:
+            case STY:
+                if (!operand(m, WRITE, lo, hi)) {
+                    return REFUSED;
+                }
+                a.load(EAX, k == STA ? REG_A : k == STX ? REG_X : REG_Y);
+                a.store(EAX, ECX, RAM);
+                base += 1;
+                break;
+            case ADC:
+            case SBC:
+                if (!operand(m, READ, lo, hi)) {
+                    return REFUSED;
+                }
+                if (k == SBC) {
+                    a.op(XOR, EDX, 0xFF);
+                }
+                a.load(EAX, REG_A);
+                a.mov(ECX, EAX);
+                a.op(ADD, EAX, EDX);
+                a.load(ESI, flag(CPUState::C));
+                a.op(ADD, EAX, ESI);
+                a.op(CMP, EAX, 0xFF);
+                a.set(ABOVE, flag(CPUState::C));
+                // V = ~(A ^ p) & (A ^ r) & 0x80
+                a.op(XOR, EDX, ECX);
+                a.not_(EDX);
+                a.op(XOR, ECX, EAX);
+                a.op(AND, ECX, EDX);
+                a.test(ECX, 0x80);
+                a.set(NOT_ZERO, flag(CPUState::V));
+                a.store(EAX, REG_A);
+                nz(EAX);
+                base += 1;
+                break;
+            case ORA:
+            case AND_:
+            case EOR:
+                if (!operand(m, READ, lo, hi)) {
+                    return REFUSED;
+                }
+                a.load(EAX, REG_A);
+                a.op(k == ORA ? OR : k == AND_ ? AND : XOR, EAX, EDX);
+                a.store(EAX, REG_A);
+                nz(EAX);
+                base += 1;
+                break;
+            case CMP_:
+            case CPX:
+            case CPY:
+                if (!operand(m, READ, lo, hi)) {
+                    return REFUSED;
+                }
+                a.load(EAX, k == CMP_ ? REG_A : k == CPX ? REG_X : REG_Y);
+                a.mov(ECX, EAX);
+                a.op(SUB, ECX, EDX);
+                nz(ECX);
+                a.op(CMP, EAX, EDX);
+                a.set(ABOVE_EQUAL, flag(CPUState::C));
+                base += 1;
+                break;
+            case BIT:
+                if (!operand(m, READ, lo, hi)) {
+                    return REFUSED;
+                }
+                // N from bit 7 of the operand moved up to bit 8, Z from A & operand
+                a.load(EAX, REG_A);
+                a.op(AND, EAX, EDX);
+                a.mov(ECX, EDX);
+                a.op(AND, ECX, 0x80);
+                a.shl(ECX, 1);
+                a.op(OR, EAX, ECX);
+                a.store16(EAX, NZ);
+                a.test(EDX, 0x40);
+                a.set(NOT_ZERO, flag(CPUState::V));
+                base += 1;
+                break;
+            case INC:
+            case DEC:
+            case ASL:
+            case LSR:
+            case ROR:
+                if (!operand(m, MODIFY, lo, hi)) {
+                    return REFUSED;
+                }
+                a.load(EAX, ECX, RAM);
+                if (k == INC || k == DEC) {
+                    a.op(k == INC ? ADD : SUB, EAX, 1);
+                } else {
+                    shift(k);
+                }
+                a.store(EAX, ECX, RAM);
+                nz(EAX);
+                base += 3;
+                break;
+            case ASL_A:
+            case LSR_A:
+            case ROR_A:
+            case ROL_A:
+                a.load(EAX, REG_A);
+                shift(k);
+                a.store(EAX, REG_A);
+                nz(EAX);
+                base += 1;
+                break;
+            case INX:
+            case INY:
+            case DEX:
+            case DEY: {
+                int r = k == INX || k == DEX ? REG_X : REG_Y;
+                if (k == INX || k == INY) {
+                    a.inc(r);
+                } else {
+                    a.dec(r);
+                }
+                a.load(EAX, r);
+                nz(EAX);
+                base += 1;
+                break;
+            }
+            case TAX:
+            case TAY:
+            case TXA:
+            case TYA:
+            case TSX:
+            case TXS: {
+                static const int from[] = {REG_A, REG_A, REG_X, REG_Y, REG_S, REG_X};
+                static const int to[] = {REG_X, REG_Y, REG_A, REG_A, REG_X, REG_S};
+                a.load(EAX, from[k - TAX]);
+                a.store(EAX, to[k - TAX]);
+                if (k != TXS) {
+                    nz(EAX);
+                }
+                base += 1;
+                break;
+            }
+            case CLC:
+            case SEC:
+            case CLI:
+            case SEI:
+            case CLD:
+            case SED:
+            case CLV: {
+                static const CPUState::Flag flags[] = {CPUState::C, CPUState::C, CPUState::I, CPUState::I,
+                                                       CPUState::D, CPUState::D, CPUState::V};
+                a.store_imm(flag(flags[k - CLC]), k == SEC || k == SEI || k == SED);
+                base += 1;
+                break;
+            }
+            case NOP:
+                base += 1;
+                break;
+            case PHA:
+                a.load(EAX, REG_A);
+                push(EAX);
+                base += 2;
+                break;
+            case PHP:
+                a.mov(EAX, 0x30);
+                for (CPUState::Flag f : {CPUState::C, CPUState::I, CPUState::D, CPUState::V}) {
+                    a.load(EDX, flag(f));
+                    if (flagBits[f]) {
+                        a.shl(EDX, flagBits[f]);
+                    }
+                    a.op(OR, EAX, EDX);
+                }
+                a.load16(ECX, NZ);
+                a.mov(EDX, 0);
+                a.test(ECX, 0xFF);
+                a.set(ZERO, EDX);
+                a.shl(EDX, 1);
+                a.op(OR, EAX, EDX);
+                a.mov(EDX, 0);
+                a.test(ECX, 0x180);
+                a.set(NOT_ZERO, EDX);
+                a.shl(EDX, 7);
+                a.op(OR, EAX, EDX);
+                push(EAX);
+                base += 2;
+                break;
+            case PLA:
+                pop(EAX);
+                a.store(EAX, REG_A);
+                nz(EAX);
+                base += 3;
+                break;
+            case PLP:
+                pop(EAX);
+                for (CPUState::Flag f : {CPUState::C, CPUState::I, CPUState::D, CPUState::V}) {
+                    a.mov(EDX, EAX);
+                    if (flagBits[f]) {
+                        a.shr(EDX, flagBits[f]);
+                    }
+                    a.op(AND, EDX, 1);
+                    a.store(EDX, flag(f));
+                }
+                // N to bit 8, and a low byte of 0 for Z
+                a.mov(ECX, EAX);
+                a.op(AND, ECX, 0x80);
+                a.shl(ECX, 1);
+                a.mov(EDX, EAX);
+                a.shr(EDX, 1);
+                a.op(AND, EDX, 1);
+                a.op(XOR, EDX, 1);
+                a.op(OR, ECX, EDX);
+                a.store16(ECX, NZ);
+                cycles += base + 3;
+                maxCycles += base + 3;
+                return END_AFTER;
+            case BRANCH: {
+                // BPL BMI BVC BVS BCC BCS BNE BEQ: flag by the top two bits, taken on the third
+                static const CPUState::Flag flags[] = {CPUState::N, CPUState::V, CPUState::C, CPUState::Z};
+                bool onSet = op & 0x20;
+                u16 next = at + 2;
+                u16 target = next + (s8) lo;
+                // the way CPU::cross counts it, the offset taken as unsigned
+                bool cross = ((next + lo) & 0xFF00) != (next & 0xFF00);
+                int taken = cycles + base + 2 + cross;
+                CPUState::Flag f = flags[op >> 6];
+                Cond set = NOT_ZERO;  // how the flag being set shows
+                if (f == CPUState::Z) {
+                    a.load16(ECX, NZ);
+                    a.test(ECX, 0xFF);
+                    set = ZERO;
+                } else if (f == CPUState::N) {
+                    a.load16(ECX, NZ);
+                    a.test(ECX, 0x180);
+                } else {
+                    a.cmp_imm(flag(f), 0);
+                }
+                exits[exitCount++] = {a.jump(onSet ? set : (Cond) (set ^ 1)), target, taken, op, (s8) lo < 0};
+                if ((s8) lo < 0) {
+                    loopAt = at;
+                }
+                exit(next, cycles + base + 1, op);
+                cycles = taken;
+                maxCycles += base + 3;
+                return ENDED;
+            }
+            case JMP: {
+                u16 target = lo | hi << 8;
+                cycles += base;
+                maxCycles += base;
+                if (target <= at) {
+                    loopAt = at;
+                }
+                exit(target, cycles, op, target <= at);
+                return ENDED;
+            }
+            case JSR: {
+                u16 ret = at + 2;
+                push_imm(ret >> 8);
+                push_imm(ret);
+                cycles += base + 3;
+                maxCycles += base + 3;
+                exit(lo | hi << 8, cycles, op);
+                return ENDED;
+            }
+            case RTS:
+                pop(EAX);
+                pop(EDX);
+                a.shl(EDX, 8);
+                a.op(OR, EAX, EDX);
+                a.op(ADD, EAX, 1);
+                a.store16(EAX, REG_PC);
+                cycles += base + 5;
+                maxCycles += base + 5;
+                exit_here(cycles, op, false);
+                return ENDED;
+            default:
+                return REFUSED;
+        }
+        cycles += base;
+        maxCycles += base + crosses;
+        return k == CLI ? END_AFTER : NEXT;
+    }
+}
+
+bool Jit::available() {
+    static int works = -1;
+    if (works < 0) {
+        void *p = mmap(nullptr, 4096, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        works = p != MAP_FAILED;
+        if (works) {
+            munmap(p, 4096);
+        }
+    }
+    return works;
+}
+
+Jit::Jit(Mapper &mapper) : mapper(mapper), codeSize(16 << 20) {
+    code = (u8 *) mmap(nullptr, codeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (code == MAP_FAILED) {
+        code = nullptr;
+        codeSize = 0;
+    }
+    memset(recent, 0, sizeof(recent));
+}
+
+Jit::~Jit() {
+    if (code) {
+        munmap(code, codeSize);
+    }
+}
+
+const Jit::Block *Jit::find(u16 pc) {
+    u64 key = (u64) mapper.prg_offset(pc) << 16 | pc;
+    auto found = blocks.find(key);
+    if (found == blocks.end()) {
+        // out of space: start again, whatever runs will be compiled again
+        if (codeSize - codeUsed < BLOCK_SPACE) {
+            flush();
+        }
+        Block &b = blocks[key];
+        b.code = nullptr;
+        b.pc = pc;
+        b.romOffset = mapper.prg_offset(pc);
+        b.maxCycles = 0;
+        b.loopAt = 0;
+        if (codeSize - codeUsed >= BLOCK_SPACE) {
+            compile(b);
+        }
+        found = blocks.find(key);
+    }
+    recent[pc & 0x7FFF] = &found->second;
+    return &found->second;
+}
+
+void Jit::compile(Block &b) {
+    Compiler compiler(code + codeUsed, mapper);
+    if (compiler.translate(b)) {
+        b.code = (Code) (code + codeUsed);
+        codeUsed += compiler.size();
+        compiledCount++;
+    }
+}
+
+void Jit::flush() {
+    blocks.clear();
+    memset(recent, 0, sizeof(recent));
+    codeUsed = 0;
+}
+
+#else
+
+// no recompiler for this machine, nothing creates a Jit when available() is false
+
+bool Jit::available() { return false; }
+
+Jit::Jit(Mapper &mapper) : mapper(mapper), code(nullptr), codeSize(0) {}
+
+Jit::~Jit() {}
+
+const Jit::Block *Jit::find(u16) { return nullptr; }
+
+void Jit::compile(Block &) {}
+
+void Jit::flush() {}
+
+#endif
@@ -1,11 +1,52 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include "unistd.h"
 
 #include "include/gui.hpp"
-#include "include/cartridge.hpp"
+#include "include/console.hpp"
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom.nes [-runahead N] [-sync timer|vsync|audio] [-play movie] [-record movie]\n", name);
+}
 
 int main(int argc, char *argv[]) {
     //std::cout << "the ROM we are using is " << argv[1] << std::endl;
-    Cartridge::load(argv[1]);
-    return GUI::init();
-}
\ No newline at end of file
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    GUI::Options options;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "-runahead") && i + 1 < argc) {
+            options.runAhead = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-play") && i + 1 < argc) {
+            options.play = argv[++i];
+        } else if (!strcmp(argv[i], "-record") && i + 1 < argc) {
+            options.record = argv[++i];
+        } else if (!strcmp(argv[i], "-vsync")) {
+            options.sync = FramePacer::vsync;
+        } else if (!strcmp(argv[i], "-sync") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "vsync")) {
+                options.sync = FramePacer::vsync;
+            } else if (!strcmp(argv[i], "audio")) {
+                options.sync = FramePacer::audio;
+            } else if (!strcmp(argv[i], "timer")) {
+                options.sync = FramePacer::timer;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    }
+    Console *console = new Console();
+    if (!console->load(argv[1])) {
+        delete console;
+        return 1;
+    }
+    int result = GUI::init(*console, options);
+    delete console;
+    return result;
+}
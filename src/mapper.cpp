@@ -1,16 +1,15 @@
-#include <iostream>
 #include <cstdio>
 #include "include/mapper.hpp"
 #include "include/common.hpp"
 
-Mapper::Mapper(u8 *rom) : rom(rom) {
+Mapper::Mapper(const u8 *rom, PPU &ppu) : ppu(ppu) {
     prgSize = rom[4] * 0x4000;
     chrSize = rom[5] * 0x2000;
     prgRamSize = rom[8] ? rom[8] * 0x2000 : 0x2000;
 
-    std::cout << (int) prgSize << " is the size of prg" << std::endl;
-    printf("size of chr size is %d\n", chrSize);
-    printf("size of prg ram size is %d", prgRamSize);
+    fprintf(stderr, "%d is the size of prg\n", prgSize);
+    fprintf(stderr, "size of chr size is %d\n", chrSize);
+    fprintf(stderr, "size of prg ram size is %d\n", prgRamSize);
 
     prg = rom + 16;
     prgRam = new u8[prgRamSize];
@@ -22,38 +21,130 @@ Mapper::Mapper(u8 *rom) : rom(rom) {
     if (chrSize) {
         chr = rom + 16 + prgSize;
     } else {
-        printf("ITs RAMMMMM");
-        chrRam = true;
+        fprintf(stderr, "ITs RAMMMMM\n");
         chrSize = 0x2000;
-        chr = new u8[0x2000];
+        chrRam = new u8[0x2000];
+        chr = chrRam;
     }
+    memset(chrRowGeneration, 0, sizeof(chrRowGeneration));
+
+    chrMap[0] = chrMap[1] = nullptr;
+    map_prg<32>(0, 0);
+    map_chr<8>(0, 0);
 }
 
 Mapper::~Mapper() {
-    delete rom;
-    delete prgRam;
-    if (chr) {
-        delete chr;
-    }
+    delete[] prgRam;
+    delete[] chrRam;
 }
 
 u8 Mapper::read(u16 addr) {
 
     if (addr >= 0x8000) {
-        return prg[(addr - 0x8000) % prgSize];
-    } else {
+        return prg_read(addr);
+    } else if (addr >= 0x6000) {
         return prgRam[addr - 0x6000];
     }
+    return 0;
+}
+
+//no registers, only PRG RAM can be written
+u8 Mapper::write(u16 addr, u8 val) {
+    if (addr >= 0x6000 && addr < 0x8000) {
+        prgRam[addr - 0x6000] = val;
+    }
+    return val;
+}
+
+size_t Mapper::state_size() const {
+    return prgRamSize + (chrRam ? 0x2000 : 0);
+}
+
+void Mapper::save_state(u8 *out) const {
+    memcpy(out, prgRam, prgRamSize);
+    if (chrRam) {
+        memcpy(out + prgRamSize, chrRam, 0x2000);
+    }
+}
+
+void Mapper::load_state(const u8 *in) {
+    memcpy(prgRam, in, prgRamSize);
+    if (chrRam) {
+        memcpy(chrRam, in + prgRamSize, 0x2000);
+        invalidate_chr();
+    }
+}
+
+/*
+ * spread the 8 bits of a pattern plane out to every other bit, so
+ * the low and high planes can be merged with a shift and an or
+ */
+static u16 spread_bits(u8 b) {
+    u16 r = 0;
+    for (int i = 0; i < 8; i++) {
+        r |= (u16) NTH_BIT(b, i) << (i * 2);
+    }
+    return r;
+}
+
+static u8 reverse_bits(u8 b) {
+    u8 r = 0;
+    for (int i = 0; i < 8; i++) {
+        r |= NTH_BIT(b, i) << (7 - i);
+    }
+    return r;
+}
+
+void Mapper::decode_chr_row(int index, u16 addr) {
+    u8 low = chr_read(addr);
+    u8 high = chr_read(addr + 8);
+    chrRows[index] = spread_bits(low) | spread_bits(high) << 1;
+    chrRowsFlipped[index] = spread_bits(reverse_bits(low)) | spread_bits(reverse_bits(high)) << 1;
+    chrRowGeneration[index] = chrGeneration;
 }
 
 u8 Mapper::chr_read(u16 addr) {
-    return chr[addr % chrSize];
+    return chrMap[addr >> 12][addr & 0xFFF];
 }
 
+u8 Mapper::chr_write(u16 addr, u8 v) {
+    if (chrRam) {
+        chrRam[(chrMap[addr >> 12] - chr) + (addr & 0xFFF)] = v;
+    }
+    return v;
+}
+
+/*
+ * point a pageKBs sized slot of $8000-$FFFF at PRG bank, negative banks
+ * count back from the end of PRG-ROM
+ */
 template<int pageKBs>
 void Mapper::map_prg(int slot, int bank) {
+    if (bank < 0) {
+        bank = (prgSize / (0x400 * pageKBs)) + bank;
+    }
+    for (int i = 0; i < pageKBs / 8; i++) {
+        prgMap[(pageKBs / 8) * slot + i] = prg + (pageKBs * 0x400 * bank + 0x2000 * i) % prgSize;
+    }
 }
 
+/*
+ * point a pageKBs sized slot of the pattern tables at CHR bank
+ */
 template<int pageKBs>
 void Mapper::map_chr(int slot, int bank) {
+    for (int i = 0; i < pageKBs / 4; i++) {
+        const u8 *page = chr + (pageKBs * 0x400 * bank + 0x1000 * i) % chrSize;
+        if (chrMap[(pageKBs / 4) * slot + i] != page) {
+            chrMap[(pageKBs / 4) * slot + i] = page;
+            invalidate_chr();
+        }
+    }
 }
+
+template void Mapper::map_prg<8>(int, int);
+template void Mapper::map_prg<16>(int, int);
+template void Mapper::map_prg<32>(int, int);
+
+template void Mapper::map_chr<4>(int, int);
+template void Mapper::map_chr<8>(int, int);
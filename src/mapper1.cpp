@@ -7,37 +7,39 @@
 #include "include/ppu.hpp"
 #include <stdio.h>
 
-u8 Mapper1::read(u16 addr) {
+void Mapper1::update_banks() {
     u8 romReadMode = (mapperControl >> 2) & 0b11;
+    u8 bank = prgBank & 0xF;
 
-    if (romReadMode <= 1) {
-        int index = addr - 0x8000;
-        index = index + (prgBank * 0x8000);
-        return prg[index];
+    switch (romReadMode) {
+        case 0:
+        case 1:
+            // 32KB at $8000, low bit of the bank ignored
+            map_prg<32>(0, bank >> 1);
+            break;
+        case 2:
+            // first bank fixed at $8000, switch $C000
+            map_prg<16>(0, 0);
+            map_prg<16>(1, bank);
+            break;
+        case 3:
+            // switch $8000, last bank fixed at $C000
+            map_prg<16>(0, bank);
+            map_prg<16>(1, -1);
+            break;
     }
-    if (addr >= 0xC000) {
-        int index = addr - 0xC000;
-        if (romReadMode == 3) {
-            index = index + ((prgBanks-1) * 0x4000);
-        } else {
-            index = index + (prgBank * 0x4000);
-        }
-        return prg[index];
-    } else if (addr >= 0x8000) {
-        int index = addr - 0x8000;
-        if (romReadMode == 2) {
-            index = index + ((prgBanks-1) * 0x4000);
-        } else {
-            index = index + (prgBank * 0x4000);
-        }
-        return prg[index];
+
+    if ((mapperControl >> 4) & 1) {
+        map_chr<4>(0, chrBank0);
+        map_chr<4>(1, chrBank1);
+    } else {
+        map_chr<8>(0, chrBank0 >> 1);
     }
-    return Mapper::read(addr);
 }
 
 u8 Mapper1::write(u16 addr, u8 v) {
     if (addr >= 0x8000) {
-        printf("writing to addr 0x%X  val:dd %X\n", addr, v);
+//        printf("writing to addr 0x%X  val:dd %X\n", addr, v);
         if (v > 0x80) {
             mapperControl |= 0x0C;
             shifter = 0;
@@ -52,19 +54,16 @@ u8 Mapper1::write(u16 addr, u8 v) {
                     mapperControl = shifter;
                     switch (mapperControl & 3) {
                         case 0:
-                            printf("single screen NT 2\n");
-                            printf("%X\n",mapperControl);
-                            PPU::set_mirroring(PPU::singleLow);
+                            ppu.set_mirroring(PPU::singleLow);
                             break;
                         case 1:
-                            printf("single screen NT 1\n");
-                            PPU::set_mirroring(PPU::singleHigh);
+                            ppu.set_mirroring(PPU::singleHigh);
                             break;
                         case 2:
-                            PPU::set_mirroring(PPU::vertical);
+                            ppu.set_mirroring(PPU::vertical);
                             break;
                         case 3:
-                            PPU::set_mirroring(PPU::horizontal);
+                            ppu.set_mirroring(PPU::horizontal);
                             break;
                     }
                     break;
@@ -81,27 +80,24 @@ u8 Mapper1::write(u16 addr, u8 v) {
             shifter = 0;
             shiftCount = 0;
         }
-    } else {
+        update_banks();
+    } else if (addr >= 0x6000) {
         prgRam[addr - 0x6000] = v;
     }
     return v;
 }
 
-u8 Mapper1::chr_read(u16 addr) {
-    u8 readMode = (mapperControl >> 4) & 1;
-    if (readMode) {
-        if (addr >= 0x1000) {
-            return chr[0x1000 * chrBank0 + addr];
-        } else {
-            return chr[0x1000 * chrBank1 + addr];
-        }
-    } else {
-       return chr[0x2000 * ((chrBank0 >> 1) & 0b1111) + addr];
-    }
-    return 0;
+size_t Mapper1::state_size() const {
+    return Mapper::state_size() + sizeof(Mapper1State);
 }
 
-u8 Mapper1::chr_write(u16 addr, u8 v) {
-    chr[addr] = v;
-    return v;
+void Mapper1::save_state(u8 *out) const {
+    Mapper::save_state(out);
+    memcpy(out + Mapper::state_size(), static_cast<const Mapper1State *>(this), sizeof(Mapper1State));
+}
+
+void Mapper1::load_state(const u8 *in) {
+    Mapper::load_state(in);
+    memcpy(static_cast<Mapper1State *>(this), in + Mapper::state_size(), sizeof(Mapper1State));
+    update_banks();
 }
@@ -0,0 +1,65 @@
+#include <cstdio>
+#include <cstring>
+#include "include/movie.hpp"
+#include "include/console.hpp"
+
+namespace {
+
+    const char MAGIC[4] = {'N', 'E', 'S', 'M'};
+    const u32 VERSION = 1;
+
+    struct Header {
+        char magic[4];
+        u32 version;
+        u64 romHash;
+        u32 frames;
+        u32 reserved;
+    };
+}
+
+void Movie::truncate(size_t frame) {
+    if (frame < frames()) {
+        input.resize(frame * 2);
+    }
+}
+
+void Movie::play(Console &console, size_t frame) const {
+    console.set_input(0, buttons(frame, 0));
+    console.set_input(1, buttons(frame, 1));
+}
+
+bool Movie::save(const char *fileName) const {
+    FILE *f = fopen(fileName, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    Header h;
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.romHash = romHash;
+    h.frames = frames();
+    h.reserved = 0;
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(input.data(), 1, input.size(), f);
+    return fclose(f) == 0;
+}
+
+bool Movie::load(const char *fileName) {
+    input.clear();
+    FILE *f = fopen(fileName, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    Header h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && !memcmp(h.magic, MAGIC, sizeof(MAGIC)) && h.version == VERSION;
+    if (ok) {
+        input.resize((size_t) h.frames * 2);
+        ok = fread(input.data(), 1, input.size(), f) == input.size();
+        romHash = h.romHash;
+    }
+    fclose(f);
+    if (!ok) {
+        input.clear();
+    }
+    return ok;
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "include/pacer.hpp"
+
+FramePacer::FramePacer(Mode mode, double fps)
+        : pacing(mode),
+          period(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps))),
+          intervals(600) {}
+
+void FramePacer::wait() {
+    Clock::time_point now = Clock::now();
+    if (!started) {
+        started = true;
+        deadline = now + period;
+        last = now;
+        return;
+    }
+
+    if (pacing != vsync) {
+        if (now > deadline + 2 * period) {
+            // fell well behind (window dragged, debugger), don't rush to catch up
+            deadline = now;
+        }
+        if (deadline - now > margin) {
+            Clock::time_point wake = deadline - margin;
+            std::this_thread::sleep_until(wake);
+            Clock::duration late = Clock::now() - wake;
+            // grow straight away when sleeps get worse, shrink slowly
+            if (late > margin) {
+                margin = late + late / 4;
+            } else if (margin > std::chrono::microseconds(200)) {
+                margin -= margin / 64;
+            }
+        }
+        while (Clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        deadline += period;
+    }
+
+    now = Clock::now();
+    intervals[next] = std::chrono::duration<double, std::milli>(now - last).count();
+    next = (next + 1) % intervals.size();
+    count = std::min(count + 1, intervals.size());
+    last = now;
+}
+
+FramePacer::Stats FramePacer::stats() const {
+    Stats s = {(int) count, 0, 0, 0};
+    if (count == 0) {
+        return s;
+    }
+    double target = std::chrono::duration<double, std::milli>(period).count();
+    std::vector<double> jitter(count);
+    double total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += intervals[i];
+        jitter[i] = std::fabs(intervals[i] - target);
+    }
+    s.meanMs = total / count;
+    size_t p99 = (count * 99) / 100;
+    if (p99 >= count) {
+        p99 = count - 1;
+    }
+    std::nth_element(jitter.begin(), jitter.begin() + p99, jitter.end());
+    s.p99JitterMs = jitter[p99];
+    s.maxJitterMs = *std::max_element(jitter.begin(), jitter.end());
+    return s;
+}
+
+RateControl::RateControl(size_t target, double maxAdjust)
+        : target(target > 0 ? target : 1), maxAdjust(maxAdjust), smoothed(target) {}
+
+/*
+ * The buffer level jumps by a whole device callback at a time, smooth it
+ * over a few frames so the ratio doesn't wobble with it.  The correction
+ * is proportional to how far off target the level is, all of maxAdjust
+ * by the time it is half the target away.
+ */
+double RateControl::update(size_t fill) {
+    smoothed += (fill - smoothed) * 0.1;
+    double error = (target - smoothed) / target;
+    current = 1 + std::max(-maxAdjust, std::min(maxAdjust, 2 * error * maxAdjust));
+    return current;
+}
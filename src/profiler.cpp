@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <string>
+#include "include/profiler.hpp"
+#include "include/mapper.hpp"
+
+Profiler::Profiler(u32 prgSize) : entries(0x8000 + prgSize) {
+    nodes.push_back({0, 0, 0, 0});
+}
+
+u32 Profiler::location(u16 addr, const Mapper &mapper) {
+    return addr < 0x8000 ? addr : 0x8000 + mapper.prg_offset(addr);
+}
+
+void Profiler::call(u32 location, u16 addr, int cycles) {
+    if (depth == MAX_DEPTH) {
+        // too deep to be real, keep count so the returns still line up
+        overflow++;
+        nodes[current].cycles += cycles;
+        return;
+    }
+    u64 key = (u64) current << 32 | location;
+    auto found = children.find(key);
+    if (found != children.end()) {
+        current = found->second;
+    } else {
+        nodes.push_back({current, location, addr, 0});
+        current = nodes.size() - 1;
+        children[key] = current;
+    }
+    depth++;
+    nodes[current].cycles += cycles;
+}
+
+void Profiler::ret() {
+    if (overflow > 0) {
+        overflow--;
+    } else if (depth > 0) {
+        depth--;
+        current = nodes[current].parent;
+    }
+}
+
+/*
+ * RAM and PRG RAM by address, PRG-ROM by 16KB bank and the address it
+ * ran at
+ */
+void Profiler::name(char *out, size_t size, u32 location, u16 addr) {
+    if (location < 0x8000) {
+        snprintf(out, size, "$%04X", location);
+    } else {
+        snprintf(out, size, "bank%u:$%04X", (location - 0x8000) / 0x4000, addr);
+    }
+}
+
+void Profiler::write_report(FILE *out, int top) const {
+    std::vector<u32> used;
+    u64 totalCycles = 0, totalInstructions = 0;
+    for (u32 i = 0; i < entries.size(); i++) {
+        if (entries[i].instructions > 0) {
+            used.push_back(i);
+            totalCycles += entries[i].cycles;
+            totalInstructions += entries[i].instructions;
+        }
+    }
+    std::sort(used.begin(), used.end(), [this](u32 a, u32 b) {
+        return entries[a].cycles > entries[b].cycles;
+    });
+
+    fprintf(out, "%llu instructions, %llu cycles, %zu locations\n\n",
+            (unsigned long long) totalInstructions, (unsigned long long) totalCycles, used.size());
+    fprintf(out, "%12s %7s %12s %6s  %s\n", "cycles", "%", "instructions", "cpi", "location");
+    for (size_t i = 0; i < used.size() && (int) i < top; i++) {
+        const Entry &e = entries[used[i]];
+        char where[32];
+        name(where, sizeof(where), used[i], e.addr);
+        fprintf(out, "%12llu %6.2f%% %12llu %6.2f  %s\n",
+                (unsigned long long) e.cycles, 100.0 * e.cycles / (totalCycles ? totalCycles : 1),
+                (unsigned long long) e.instructions, (double) e.cycles / e.instructions, where);
+    }
+
+    if (fusions.empty()) {
+        return;
+    }
+    fprintf(out, "\n%12s %12s %7s  %s\n", "seen", "fused", "%", "idiom");
+    for (const Fusion &f : fusions) {
+        if (f.seen > 0) {
+            fprintf(out, "%12llu %12llu %6.2f%%  %s\n", (unsigned long long) f.seen,
+                    (unsigned long long) f.fused, 100.0 * f.fused / f.seen, f.name);
+        }
+    }
+}
+
+void Profiler::write_folded(FILE *out) const {
+    for (u32 i = 0; i < nodes.size(); i++) {
+        if (nodes[i].cycles == 0) {
+            continue;
+        }
+        // walk up to the root, then print the frames top down
+        std::vector<u32> path;
+        for (u32 n = i; n != 0; n = nodes[n].parent) {
+            path.push_back(n);
+        }
+        std::string line = "reset";
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            char frame[32];
+            name(frame, sizeof(frame), nodes[*it].location, nodes[*it].addr);
+            line += ';';
+            line += frame;
+        }
+        fprintf(out, "%s %llu\n", line.c_str(), (unsigned long long) nodes[i].cycles);
+    }
+}
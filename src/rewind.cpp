@@ -0,0 +1,123 @@
+#include <cstring>
+#include "include/rewind.hpp"
+#include "include/console.hpp"
+
+Rewind::Rewind(int frames, int keyframeInterval)
+        : ring(frames > 2 ? frames : 2), keyframeInterval(keyframeInterval > 0 ? keyframeInterval : 1) {}
+
+void Rewind::clear() {
+    count = 0;
+}
+
+/*
+ * a keyframe takes every delta after it along when it leaves the ring,
+ * they can't be decoded without it
+ */
+void Rewind::drop_oldest() {
+    do {
+        count--;
+    } while (count > 0 && !entry(next - count).full);
+}
+
+/*
+ * Delta format: pairs of u16 run lengths, zeros to skip then bytes that
+ * follow as XOR against the keyframe, until the whole state is covered.
+ */
+void Rewind::encode(Entry &e, const u8 *key) {
+    e.data.clear();
+    size_t i = 0;
+    while (i < stateSize) {
+        size_t start = i;
+        while (i < stateSize && i - start < 0xFFFF && state[i] == key[i]) {
+            i++;
+        }
+        u16 skip = i - start;
+        start = i;
+        // a couple of equal bytes are cheaper to keep than a new pair
+        while (i < stateSize && i - start < 0xFFFF
+               && (state[i] != key[i] || (i + 4 < stateSize && memcmp(&state[i + 1], &key[i + 1], 4) != 0))) {
+            i++;
+        }
+        u16 length = i - start;
+        e.data.push_back(skip);
+        e.data.push_back(skip >> 8);
+        e.data.push_back(length);
+        e.data.push_back(length >> 8);
+        for (size_t j = start; j < i; j++) {
+            e.data.push_back(state[j] ^ key[j]);
+        }
+    }
+}
+
+void Rewind::decode(const Entry &e) {
+    const std::vector<u8> &key = entry(e.keyframe).data;
+    memcpy(state.data(), key.data(), stateSize);
+    if (e.full) {
+        return;
+    }
+    size_t i = 0;
+    const u8 *p = e.data.data();
+    const u8 *end = p + e.data.size();
+    while (p < end) {
+        i += p[0] | p[1] << 8;
+        u16 length = p[2] | p[3] << 8;
+        p += 4;
+        for (u16 j = 0; j < length; j++) {
+            state[i++] ^= *p++;
+        }
+    }
+}
+
+void Rewind::push(const Console &console) {
+    size_t size = console.state_size();
+    if (size != stateSize) {
+        // new ROM, nothing we hold fits any more
+        stateSize = size;
+        state.resize(size);
+        count = 0;
+    }
+    console.save_state(state.data());
+
+    if (count == (int) ring.size()) {
+        drop_oldest();
+    }
+    // the keyframe may be gone, stepped back past or pushed out
+    bool keyframeHeld = count > 0 && lastKeyframe >= next - count && lastKeyframe < next;
+    Entry &e = entry(next);
+    e.input[0] = console.controller.buttons[0];
+    e.input[1] = console.controller.buttons[1];
+    if (!keyframeHeld || next - lastKeyframe >= (u64) keyframeInterval) {
+        e.full = true;
+        e.keyframe = next;
+        e.data.assign(state.begin(), state.end());
+        lastKeyframe = next;
+    } else {
+        e.full = false;
+        e.keyframe = lastKeyframe;
+        encode(e, entry(lastKeyframe).data.data());
+    }
+    next++;
+    count++;
+}
+
+/*
+ * the newest state is where the console is now, drop it, then rebuild
+ * the one before from the state before that and the input it ran with
+ */
+bool Rewind::step_back(Console &console) {
+    if (count < 3) {
+        return false;
+    }
+    const Entry &previous = entry(next - 2);
+    decode(entry(next - 3));
+    if (!console.load_state(state.data(), stateSize)) {
+        clear();
+        return false;
+    }
+    console.set_input(0, previous.input[0]);
+    console.set_input(1, previous.input[1]);
+    next--;
+    count--;
+    console.run_frame();
+    return true;
+}
@@ -0,0 +1,166 @@
+#include <cstring>
+#include "include/trace.hpp"
+
+namespace {
+
+    const char MAGIC[4] = {'N', 'E', 'S', 'T'};
+    const u32 VERSION = 1;
+
+    struct Header {
+        char magic[4];
+        u32 version;
+        u32 recordSize;
+        u32 reserved;
+    };
+
+    enum Mode {
+        imp, acc, imm, zp, zpx, zpy, abs, abx, aby, ind, izx, izy, rel
+    };
+
+    // operand bytes per addressing mode
+    const int operands[] = {0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 1, 1, 1};
+
+    struct Op {
+        const char *name;  // unofficial opcodes start with '*', like nestest.log has them
+        Mode mode;
+    };
+
+    const Op ops[256] = {
+        {"BRK", imp}, {"ORA", izx}, {"*KIL", imp}, {"*SLO", izx}, {"*NOP", zp}, {"ORA", zp}, {"ASL", zp}, {"*SLO", zp},
+        {"PHP", imp}, {"ORA", imm}, {"ASL", acc}, {"*ANC", imm}, {"*NOP", abs}, {"ORA", abs}, {"ASL", abs}, {"*SLO", abs},
+        {"BPL", rel}, {"ORA", izy}, {"*KIL", imp}, {"*SLO", izy}, {"*NOP", zpx}, {"ORA", zpx}, {"ASL", zpx}, {"*SLO", zpx},
+        {"CLC", imp}, {"ORA", aby}, {"*NOP", imp}, {"*SLO", aby}, {"*NOP", abx}, {"ORA", abx}, {"ASL", abx}, {"*SLO", abx},
+        {"JSR", abs}, {"AND", izx}, {"*KIL", imp}, {"*RLA", izx}, {"BIT", zp}, {"AND", zp}, {"ROL", zp}, {"*RLA", zp},
+        {"PLP", imp}, {"AND", imm}, {"ROL", acc}, {"*ANC", imm}, {"BIT", abs}, {"AND", abs}, {"ROL", abs}, {"*RLA", abs},
+        {"BMI", rel}, {"AND", izy}, {"*KIL", imp}, {"*RLA", izy}, {"*NOP", zpx}, {"AND", zpx}, {"ROL", zpx}, {"*RLA", zpx},
+        {"SEC", imp}, {"AND", aby}, {"*NOP", imp}, {"*RLA", aby}, {"*NOP", abx}, {"AND", abx}, {"ROL", abx}, {"*RLA", abx},
+        {"RTI", imp}, {"EOR", izx}, {"*KIL", imp}, {"*SRE", izx}, {"*NOP", zp}, {"EOR", zp}, {"LSR", zp}, {"*SRE", zp},
+        {"PHA", imp}, {"EOR", imm}, {"LSR", acc}, {"*ALR", imm}, {"JMP", abs}, {"EOR", abs}, {"LSR", abs}, {"*SRE", abs},
+        {"BVC", rel}, {"EOR", izy}, {"*KIL", imp}, {"*SRE", izy}, {"*NOP", zpx}, {"EOR", zpx}, {"LSR", zpx}, {"*SRE", zpx},
+        {"CLI", imp}, {"EOR", aby}, {"*NOP", imp}, {"*SRE", aby}, {"*NOP", abx}, {"EOR", abx}, {"LSR", abx}, {"*SRE", abx},
+        {"RTS", imp}, {"ADC", izx}, {"*KIL", imp}, {"*RRA", izx}, {"*NOP", zp}, {"ADC", zp}, {"ROR", zp}, {"*RRA", zp},
+        {"PLA", imp}, {"ADC", imm}, {"ROR", acc}, {"*ARR", imm}, {"JMP", ind}, {"ADC", abs}, {"ROR", abs}, {"*RRA", abs},
+        {"BVS", rel}, {"ADC", izy}, {"*KIL", imp}, {"*RRA", izy}, {"*NOP", zpx}, {"ADC", zpx}, {"ROR", zpx}, {"*RRA", zpx},
+        {"SEI", imp}, {"ADC", aby}, {"*NOP", imp}, {"*RRA", aby}, {"*NOP", abx}, {"ADC", abx}, {"ROR", abx}, {"*RRA", abx},
+        {"*NOP", imm}, {"STA", izx}, {"*NOP", imm}, {"*SAX", izx}, {"STY", zp}, {"STA", zp}, {"STX", zp}, {"*SAX", zp},
+        {"DEY", imp}, {"*NOP", imm}, {"TXA", imp}, {"*XAA", imm}, {"STY", abs}, {"STA", abs}, {"STX", abs}, {"*SAX", abs},
+        {"BCC", rel}, {"STA", izy}, {"*KIL", imp}, {"*AHX", izy}, {"STY", zpx}, {"STA", zpx}, {"STX", zpy}, {"*SAX", zpy},
+        {"TYA", imp}, {"STA", aby}, {"TXS", imp}, {"*TAS", aby}, {"*SHY", abx}, {"STA", abx}, {"*SHX", aby}, {"*AHX", aby},
+        {"LDY", imm}, {"LDA", izx}, {"LDX", imm}, {"*LAX", izx}, {"LDY", zp}, {"LDA", zp}, {"LDX", zp}, {"*LAX", zp},
+        {"TAY", imp}, {"LDA", imm}, {"TAX", imp}, {"*LAX", imm}, {"LDY", abs}, {"LDA", abs}, {"LDX", abs}, {"*LAX", abs},
+        {"BCS", rel}, {"LDA", izy}, {"*KIL", imp}, {"*LAX", izy}, {"LDY", zpx}, {"LDA", zpx}, {"LDX", zpy}, {"*LAX", zpy},
+        {"CLV", imp}, {"LDA", aby}, {"TSX", imp}, {"*LAS", aby}, {"LDY", abx}, {"LDA", abx}, {"LDX", aby}, {"*LAX", aby},
+        {"CPY", imm}, {"CMP", izx}, {"*NOP", imm}, {"*DCP", izx}, {"CPY", zp}, {"CMP", zp}, {"DEC", zp}, {"*DCP", zp},
+        {"INY", imp}, {"CMP", imm}, {"DEX", imp}, {"*AXS", imm}, {"CPY", abs}, {"CMP", abs}, {"DEC", abs}, {"*DCP", abs},
+        {"BNE", rel}, {"CMP", izy}, {"*KIL", imp}, {"*DCP", izy}, {"*NOP", zpx}, {"CMP", zpx}, {"DEC", zpx}, {"*DCP", zpx},
+        {"CLD", imp}, {"CMP", aby}, {"*NOP", imp}, {"*DCP", aby}, {"*NOP", abx}, {"CMP", abx}, {"DEC", abx}, {"*DCP", abx},
+        {"CPX", imm}, {"SBC", izx}, {"*NOP", imm}, {"*ISB", izx}, {"CPX", zp}, {"SBC", zp}, {"INC", zp}, {"*ISB", zp},
+        {"INX", imp}, {"SBC", imm}, {"NOP", imp}, {"*SBC", imm}, {"CPX", abs}, {"SBC", abs}, {"INC", abs}, {"*ISB", abs},
+        {"BEQ", rel}, {"SBC", izy}, {"*KIL", imp}, {"*ISB", izy}, {"*NOP", zpx}, {"SBC", zpx}, {"INC", zpx}, {"*ISB", zpx},
+        {"SED", imp}, {"SBC", aby}, {"*NOP", imp}, {"*ISB", aby}, {"*NOP", abx}, {"SBC", abx}, {"INC", abx}, {"*ISB", abx},
+    };
+}
+
+TraceLog::TraceLog(size_t capacity, FILE *stream) : capacity(capacity ? capacity : 1), stream(stream) {
+    records = new TraceRecord[this->capacity];
+    if (stream) {
+        write_header(stream);
+    }
+}
+
+TraceLog::~TraceLog() {
+    if (stream) {
+        flush();
+    }
+    delete[] records;
+}
+
+void TraceLog::write_header(FILE *out) {
+    Header h;
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.recordSize = sizeof(TraceRecord);
+    h.reserved = 0;
+    fwrite(&h, sizeof(h), 1, out);
+}
+
+void TraceLog::flush() {
+    if (!stream) {
+        return;
+    }
+    // in two pieces when the records wrap around the end of the ring
+    size_t first = head >= count ? head - count : head + capacity - count;
+    size_t run = count < capacity - first ? count : capacity - first;
+    fwrite(records + first, sizeof(TraceRecord), run, stream);
+    fwrite(records, sizeof(TraceRecord), count - run, stream);
+    count = 0;
+}
+
+bool TraceLog::save(FILE *out) const {
+    write_header(out);
+    size_t first = head >= count ? head - count : head + capacity - count;
+    size_t run = count < capacity - first ? count : capacity - first;
+    fwrite(records + first, sizeof(TraceRecord), run, out);
+    fwrite(records, sizeof(TraceRecord), count - run, out);
+    return !ferror(out);
+}
+
+bool TraceLog::read_header(FILE *in) {
+    Header h;
+    return fread(&h, sizeof(h), 1, in) == 1 && !memcmp(h.magic, MAGIC, sizeof(MAGIC)) &&
+           h.version == VERSION && h.recordSize == sizeof(TraceRecord);
+}
+
+/*
+ * C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+ *
+ * The trace doesn't keep the memory an instruction touched, so unlike
+ * nestest.log the operands don't show "= value", everything from the
+ * registers on lines up with it.
+ */
+void TraceLog::format(const TraceRecord &r, char *out, size_t size) {
+    const Op &op = ops[r.bytes[0]];
+    int n = operands[op.mode];
+    u8 lo = r.bytes[1];
+    u16 word = r.bytes[1] | r.bytes[2] << 8;
+
+    char bytes[16];
+    if (n == 0) {
+        snprintf(bytes, sizeof(bytes), "%02X", r.bytes[0]);
+    } else if (n == 1) {
+        snprintf(bytes, sizeof(bytes), "%02X %02X", r.bytes[0], lo);
+    } else {
+        snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r.bytes[0], lo, r.bytes[2]);
+    }
+
+    char operand[16];
+    switch (op.mode) {
+        case imp: operand[0] = 0; break;
+        case acc: snprintf(operand, sizeof(operand), "A"); break;
+        case imm: snprintf(operand, sizeof(operand), "#$%02X", lo); break;
+        case zp:  snprintf(operand, sizeof(operand), "$%02X", lo); break;
+        case zpx: snprintf(operand, sizeof(operand), "$%02X,X", lo); break;
+        case zpy: snprintf(operand, sizeof(operand), "$%02X,Y", lo); break;
+        case abs: snprintf(operand, sizeof(operand), "$%04X", word); break;
+        case abx: snprintf(operand, sizeof(operand), "$%04X,X", word); break;
+        case aby: snprintf(operand, sizeof(operand), "$%04X,Y", word); break;
+        case ind: snprintf(operand, sizeof(operand), "($%04X)", word); break;
+        case izx: snprintf(operand, sizeof(operand), "($%02X,X)", lo); break;
+        case izy: snprintf(operand, sizeof(operand), "($%02X),Y", lo); break;
+        case rel: snprintf(operand, sizeof(operand), "$%04X", (u16) (r.pc + 2 + (s8) lo)); break;
+    }
+
+    // the '*' of unofficial opcodes goes in the column before the mnemonic
+    const char *name = op.name;
+    char mark = ' ';
+    if (name[0] == '*') {
+        mark = '*';
+        name++;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%s%s%s", name, operand[0] ? " " : "", operand);
+
+    snprintf(out, size, "%04X  %-8s %c%-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu",
+             r.pc, bytes, mark, text, r.a, r.x, r.y, r.p, r.s, r.scanline, r.dot,
+             (unsigned long long) r.cycles);
+}
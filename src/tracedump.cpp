@@ -0,0 +1,42 @@
+//
+// Turns a binary instruction trace from nes_headless -trace into
+// nestest.log style text, one line per instruction.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "include/trace.hpp"
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s trace.bin [out.log]\n", argv[0]);
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        fprintf(stderr, "could not read %s\n", argv[1]);
+        return 1;
+    }
+    if (!TraceLog::read_header(in)) {
+        fprintf(stderr, "%s is not a trace file\n", argv[1]);
+        return 1;
+    }
+    FILE *out = stdout;
+    if (argc == 3 && (out = fopen(argv[2], "w")) == NULL) {
+        fprintf(stderr, "could not write %s\n", argv[2]);
+        return 1;
+    }
+
+    static TraceRecord records[4096];
+    char line[128];
+    for (size_t n; (n = fread(records, sizeof(TraceRecord), 4096, in)) > 0;) {
+        for (size_t i = 0; i < n; i++) {
+            TraceLog::format(records[i], line, sizeof(line));
+            fputs(line, out);
+            fputc('\n', out);
+        }
+    }
+    fclose(in);
+    return fclose(out) == 0 ? 0 : 1;
+}